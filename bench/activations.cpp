@@ -0,0 +1,99 @@
+#include "bench.hpp"
+
+#include <nntlib/nntlib.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Benchmarks the activation kernels over entire state vectors (f1_n) against
+ * a loop over the scalar function (f1), for every activation and value type.
+ * Prints the results as JSON to stdout, "width" is the vector length.
+ *
+ * Usage: activations [--quick]
+ */
+
+constexpr std::size_t n_vectors = 64;
+
+struct config {
+    std::vector<std::size_t> widths;
+    double min_seconds;
+};
+
+template <typename T>
+const char* type_name();
+
+template <>
+const char* type_name<float>() {
+    return "float";
+}
+
+template <>
+const char* type_name<double>() {
+    return "double";
+}
+
+template <typename T, typename Activation>
+void run_activation(const char* activation, const config& cfg, std::vector<bench::result>& results) {
+    for (std::size_t width : cfg.widths) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<T> dist(-4.0, 4.0);
+        std::vector<std::vector<T>> x(n_vectors, std::vector<T>(width));
+        for (auto& xi : x) {
+            for (auto& v : xi) {
+                v = dist(rng);
+            }
+        }
+        std::vector<T> y(width);
+
+        // samples are vectors, one function evaluation per element
+        bench::result base{"", type_name<T>(), activation, width, 1, 1, n_vectors, static_cast<double>(width), 0.0, 0, 0};
+
+        {
+            bench::result r = base;
+            r.name = "activation_scalar";
+            bench::measure([&]{
+                for (const auto& xi : x) {
+                    for (std::size_t i = 0; i < width; ++i) {
+                        y[i] = Activation::f1(xi[i]);
+                    }
+                }
+            }, n_vectors, cfg.min_seconds, r);
+            results.push_back(r);
+        }
+
+        {
+            bench::result r = base;
+            r.name = "activation_vector";
+            bench::measure([&]{
+                for (const auto& xi : x) {
+                    Activation::f1_n(xi.data(), y.data(), width);
+                }
+            }, n_vectors, cfg.min_seconds, r);
+            results.push_back(r);
+        }
+    }
+}
+
+template <typename T>
+void run_activations(const config& cfg, std::vector<bench::result>& results) {
+    std::cerr << "bench " << type_name<T>() << " activations" << std::endl;
+    run_activation<T, nntlib::activation::sigmoid<T>>("sigmoid", cfg, results);
+    run_activation<T, nntlib::activation::softplus<T>>("softplus", cfg, results);
+    run_activation<T, nntlib::activation::tanh<T>>("tanh", cfg, results);
+}
+
+int main(int argc, char** argv) {
+    config cfg{{64, 1024, 65536}, 0.1};
+    if ((argc > 1) && (std::strcmp(argv[1], "--quick") == 0)) {
+        cfg = config{{1024}, 0.01};
+    }
+
+    std::vector<bench::result> results;
+    run_activations<float>(cfg, results);
+    run_activations<double>(cfg, results);
+
+    bench::write_json(std::cout, results);
+}
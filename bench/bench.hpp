@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+/* Helpers for the benchmark programs. Include this header in exactly one
+ * translation unit, it replaces the global allocation functions (malloc and
+ * friends with glibc, operator new otherwise) to count allocations.
+ */
+namespace bench {
+
+inline std::atomic<std::size_t>& allocation_counter() {
+    static std::atomic<std::size_t> counter(0);
+    return counter;
+}
+
+inline std::size_t allocations() {
+    return allocation_counter().load(std::memory_order_relaxed);
+}
+
+/* Result of a single benchmark run.
+ */
+struct result {
+    std::string name;
+    std::string type;
+    std::string activation;
+    std::size_t width;
+    std::size_t depth;
+    std::size_t batch_size;
+    std::size_t n_samples;
+    double flops_per_sample;
+    double seconds;
+    std::size_t allocs;
+    std::size_t iterations;
+};
+
+/* Runs a function until a minimum time has elapsed.
+ * @func Function that processes n_samples samples per call.
+ * @n_samples Number of samples per call.
+ * @min_seconds Minimum runtime.
+ * @r Result, gets filled with time, allocations and iterations.
+ */
+template <typename Function>
+void measure(Function func, std::size_t n_samples, double min_seconds, result& r) {
+    // warm up caches and pools
+    func();
+
+    std::size_t allocs_before = allocations();
+    auto start = std::chrono::steady_clock::now();
+    std::size_t iterations = 0;
+    double elapsed = 0.0;
+    do {
+        func();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < min_seconds);
+
+    r.n_samples = n_samples;
+    r.seconds = elapsed;
+    r.allocs = allocations() - allocs_before;
+    r.iterations = iterations;
+}
+
+/* Writes results as JSON array.
+ */
+inline void write_json(std::ostream& out, const std::vector<result>& results) {
+    out << "[" << std::endl;
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const result& r = results[i];
+        double samples = static_cast<double>(r.n_samples * r.iterations);
+        out << "  {"
+            << "\"bench\": \"" << r.name << "\", "
+            << "\"type\": \"" << r.type << "\", "
+            << "\"activation\": \"" << r.activation << "\", "
+            << "\"width\": " << r.width << ", "
+            << "\"depth\": " << r.depth << ", "
+            << "\"batch_size\": " << r.batch_size << ", "
+            << "\"ns_per_sample\": " << r.seconds * 1e9 / samples << ", "
+            << "\"gflops\": " << r.flops_per_sample * samples / r.seconds * 1e-9 << ", "
+            << "\"allocs_per_iteration\": " << static_cast<double>(r.allocs) / static_cast<double>(r.iterations)
+            << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+}
+
+#if defined(__GLIBC__)
+/* Replace the C allocation functions, so allocations of Eigen (malloc based)
+ * get counted as well. operator new of libstdc++ uses malloc, too.
+ */
+extern "C" {
+void* __libc_malloc(std::size_t n);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t n);
+void* __libc_memalign(std::size_t align, std::size_t n);
+void __libc_free(void* ptr);
+
+void* malloc(std::size_t n) noexcept {
+    bench::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(n);
+}
+
+void* calloc(std::size_t n, std::size_t size) noexcept {
+    bench::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, std::size_t n) noexcept {
+    bench::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, n);
+}
+
+void* memalign(std::size_t align, std::size_t n) noexcept {
+    bench::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(align, n);
+}
+
+void* aligned_alloc(std::size_t align, std::size_t n) noexcept {
+    return memalign(align, n);
+}
+
+int posix_memalign(void** ptr, std::size_t align, std::size_t n) noexcept {
+    *ptr = memalign(align, n);
+    return (*ptr != nullptr) ? 0 : ENOMEM;
+}
+
+void free(void* ptr) noexcept {
+    __libc_free(ptr);
+}
+}
+#else
+void* operator new(std::size_t n) {
+    bench::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(n == 0 ? 1 : n)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t _n) noexcept {
+    std::free(ptr);
+}
+#endif
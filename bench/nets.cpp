@@ -0,0 +1,157 @@
+#include "bench.hpp"
+
+#include <nntlib/nntlib.hpp>
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Benchmarks forward pass, backward pass and training of fully connected
+ * nets over a grid of widths, depths, activations, value types and batch
+ * sizes. Prints the results as JSON to stdout.
+ *
+ * Usage: nets [--quick]
+ */
+
+constexpr std::size_t n_outputs = 10;
+constexpr std::size_t n_samples = 256;
+
+struct config {
+    std::vector<std::size_t> widths;
+    std::vector<std::size_t> batch_sizes;
+    double min_seconds;
+};
+
+template <typename T>
+const char* type_name();
+
+template <>
+const char* type_name<float>() {
+    return "float";
+}
+
+template <>
+const char* type_name<double>() {
+    return "double";
+}
+
+template <typename Net, typename T>
+void run_net(Net& net, const char* activation, std::size_t width, std::size_t depth, const config& cfg, std::vector<bench::result>& results) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    std::vector<std::vector<T>> x(n_samples, std::vector<T>(width));
+    std::vector<std::vector<T>> y(n_samples, std::vector<T>(n_outputs));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    for (auto& yi : y) {
+        for (auto& v : yi) {
+            v = dist(rng);
+        }
+    }
+
+    // one multiply-add per weight for forward, three for forward and backward
+    double params = static_cast<double>((depth - 1) * width * width + width * n_outputs);
+    bench::result base{"", type_name<T>(), activation, width, depth, 1, n_samples, 2.0 * params, 0.0, 0, 0};
+
+    {
+        bench::result r = base;
+        r.name = "forward";
+        auto state = net.allocate_state();
+        bench::measure([&]{
+            for (const auto& xi : x) {
+                net.forward(xi.begin(), xi.end(), state);
+            }
+        }, n_samples, cfg.min_seconds, r);
+        results.push_back(r);
+    }
+
+    {
+        bench::result r = base;
+        r.name = "backward";
+        r.flops_per_sample = 6.0 * params;
+        auto state = net.allocate_state();
+        auto error = net.allocate_error_storage();
+        auto gradient = net.allocate_delta_storage();
+        bench::measure([&]{
+            for (std::size_t i = 0; i < n_samples; ++i) {
+                net.backward(x[i].begin(), x[i].end(), y[i].begin(), y[i].end(), state, error, gradient);
+            }
+        }, n_samples, cfg.min_seconds, r);
+        results.push_back(r);
+    }
+
+    for (std::size_t batch_size : cfg.batch_sizes) {
+        bench::result r = base;
+        r.name = "batch_train";
+        r.flops_per_sample = 6.0 * params;
+        r.batch_size = batch_size;
+        nntlib::training::batch<T> trainer([](std::size_t _i){return 1e-3;}, batch_size, 1);
+        bench::measure([&]{
+            trainer.train(net, x.begin(), x.end(), y.begin(), y.end());
+        }, n_samples, cfg.min_seconds, r);
+        results.push_back(r);
+    }
+
+    for (std::size_t batch_size : cfg.batch_sizes) {
+        bench::result r = base;
+        r.name = "lbfgs_train";
+        r.flops_per_sample = 6.0 * params;
+        r.batch_size = batch_size;
+        nntlib::training::lbfgs<T> trainer(5, [](std::size_t _i){return 1e-3;}, batch_size, 1);
+        bench::measure([&]{
+            trainer.train(net, x.begin(), x.end(), y.begin(), y.end());
+        }, n_samples, cfg.min_seconds, r);
+        results.push_back(r);
+    }
+}
+
+template <typename T, typename Activation>
+void run_depths(const char* activation, const config& cfg, std::vector<bench::result>& results) {
+    typedef nntlib::layer::fully_connected<Activation, T> hidden_t;
+    typedef nntlib::layer::fully_connected<nntlib::activation::identity<T>, T> out_t;
+
+    for (std::size_t width : cfg.widths) {
+        std::cerr << "bench " << type_name<T>() << " " << activation << " width=" << width << std::endl;
+        std::mt19937 rng(1);
+
+        {
+            hidden_t l1(width, width, rng);
+            out_t l2(width, n_outputs, rng);
+            auto net = nntlib::make_net<T, nntlib::loss::mse<T>>(l1, l2);
+            run_net<decltype(net), T>(net, activation, width, 2, cfg, results);
+        }
+
+        {
+            hidden_t l1(width, width, rng);
+            hidden_t l2(width, width, rng);
+            hidden_t l3(width, width, rng);
+            out_t l4(width, n_outputs, rng);
+            auto net = nntlib::make_net<T, nntlib::loss::mse<T>>(l1, l2, l3, l4);
+            run_net<decltype(net), T>(net, activation, width, 4, cfg, results);
+        }
+    }
+}
+
+template <typename T>
+void run_activations(const config& cfg, std::vector<bench::result>& results) {
+    run_depths<T, nntlib::activation::tanh<T>>("tanh", cfg, results);
+    run_depths<T, nntlib::activation::sigmoid<T>>("sigmoid", cfg, results);
+}
+
+int main(int argc, char** argv) {
+    config cfg{{64, 256, 1024}, {1, 32, 128}, 0.1};
+    if ((argc > 1) && (std::strcmp(argv[1], "--quick") == 0)) {
+        cfg = config{{64, 256}, {32}, 0.01};
+    }
+
+    std::vector<bench::result> results;
+    run_activations<float>(cfg, results);
+    run_activations<double>(cfg, results);
+
+    bench::write_json(std::cout, results);
+}
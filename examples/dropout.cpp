@@ -62,23 +62,25 @@ int main() {
         return source[i];
     };
 
-    nntlib::iterator::combine<double> combTestInputBegin;
-    nntlib::iterator::combine<double> combTestInputEnd;
-    nntlib::iterator::combine<double> combTrainInputBegin;
-    nntlib::iterator::combine<double> combTrainInputEnd;
-    for (auto& input : inputs) {
-        auto iFuncInput = std::bind(iFunc, std::placeholders::_1, std::ref(input));
-        combTestInputBegin.push_back(nntlib::iterator::make_transform(test.begin(), iFuncInput));
-        combTestInputEnd.push_back(nntlib::iterator::make_transform(test.end(), iFuncInput));
-        combTrainInputBegin.push_back(nntlib::iterator::make_transform(train.begin(), iFuncInput));
-        combTrainInputEnd.push_back(nntlib::iterator::make_transform(train.end(), iFuncInput));
-    }
+    auto col = [&](std::vector<std::size_t>::iterator it, const std::vector<double>& source) {
+        return nntlib::iterator::make_transform(it, std::bind(iFunc, std::placeholders::_1, std::cref(source)));
+    };
+    auto cols = [&](std::vector<std::size_t>::iterator it) {
+        return nntlib::iterator::make_combine(
+            col(it, inputs[0]), col(it, inputs[1]), col(it, inputs[2]), col(it, inputs[3]), col(it, inputs[4]),
+            col(it, inputs[5]), col(it, inputs[6]), col(it, inputs[7]), col(it, inputs[8]), col(it, inputs[9])
+        );
+    };
+
+    auto combTestInputBegin = cols(test.begin());
+    auto combTestInputEnd = cols(test.end());
+    auto combTrainInputBegin = cols(train.begin());
+    auto combTrainInputEnd = cols(train.end());
 
-    auto iFuncOutput = std::bind(iFunc, std::placeholders::_1, std::ref(output));
-    nntlib::iterator::combine<double> combTestOutputBegin(nntlib::iterator::make_transform(test.begin(), iFuncOutput));
-    nntlib::iterator::combine<double> combTestOutputEnd(nntlib::iterator::make_transform(test.end(), iFuncOutput));
-    nntlib::iterator::combine<double> combTrainOutputBegin(nntlib::iterator::make_transform(train.begin(), iFuncOutput));
-    nntlib::iterator::combine<double> combTrainOutputEnd(nntlib::iterator::make_transform(train.end(), iFuncOutput));
+    auto combTestOutputBegin = nntlib::iterator::make_combine(col(test.begin(), output));
+    auto combTestOutputEnd = nntlib::iterator::make_combine(col(test.end(), output));
+    auto combTrainOutputBegin = nntlib::iterator::make_combine(col(train.begin(), output));
+    auto combTrainOutputEnd = nntlib::iterator::make_combine(col(train.end(), output));
 
     std::cout << "Train:" << std::endl;
     typedef nntlib::training::batch<double> train_method_t;
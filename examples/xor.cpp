@@ -62,9 +62,8 @@ int main() {
             ++n;
         }, testInputBegin, testInputEnd, testOutputBegin, testOutputEnd);
         std::cout << "  round " << round << ": error=" << error / static_cast<double>(n) << std::endl;
-
-        std::shuffle(train.begin(), train.end(), rng);
     });
+    tm.shuffle();
     tm.train(net, trainInputBegin, trainInputEnd, trainOutputBegin, trainOutputEnd);
     std::cout << "DONE" << std::endl << std::endl;
 
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <eigen3/Eigen/Core>
+
 #include <cmath>
 
+#include <algorithm>
+#include <type_traits>
+
 
 namespace nntlib {
 
@@ -13,10 +18,101 @@ namespace nntlib {
  * using the netto input. After all f1 values are calculated, f2 is called using
  * the result of f1. This behaviour might be used to implement normalization.
  *
- * During the backward phase, the same object is used to call df on.
+ * During the backward phase, the same object is used to call df_y on. It
+ * calculates the derivative using the output y = f2(f1(x)) of the forward
+ * phase, so layers can use their cached state instead of recalculating the
+ * netto input. df calculates the same derivative using the netto input x.
+ *
+ * Additionally, f1_n and f2_n apply f1 and f2 to entire state vectors (x and y
+ * might point to the same memory). They use the SIMD kernels of Eigen (SSE,
+ * AVX2, AVX-512, depending on the compiler flags) where Eigen vectorizes the
+ * function for the value type and plain loops otherwise, and are preferred by
+ * layers when they exist. See bench/activations.cpp.
  */
 namespace activation {
 
+/* Private implementation details.
+ */
+namespace _ {
+template <typename T>
+using array_t = Eigen::Array<T, Eigen::Dynamic, 1>;
+
+template <typename T>
+Eigen::Map<const array_t<T>> map(const T* x, std::size_t n) {
+    return Eigen::Map<const array_t<T>>(x, static_cast<Eigen::Index>(n));
+}
+
+template <typename T>
+Eigen::Map<array_t<T>> map(T* x, std::size_t n) {
+    return Eigen::Map<array_t<T>>(x, static_cast<Eigen::Index>(n));
+}
+
+template <typename T>
+void copy_n(const T* x, T* y, std::size_t n) {
+    if (x != y) {
+        std::copy(x, x + n, y);
+    }
+}
+
+/* Vectorized sigmoid for float. Eigen also has an exp kernel for double, but it is slower than a loop over std::exp (see bench/activations.cpp).
+ */
+template <typename T, bool Vectorized = std::is_same<T, float>::value && Eigen::internal::packet_traits<T>::HasExp>
+struct sigmoid_n {
+    static void f(const T* x, T* y, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = 1 / (1 + std::exp(-x[i]));
+        }
+    }
+};
+
+template <typename T>
+struct sigmoid_n<T, true> {
+    static void f(const T* x, T* y, std::size_t n) {
+        map(y, n) = (1 + (-map(x, n)).exp()).inverse();
+    }
+};
+
+/* Vectorized tanh if Eigen has a packet kernel for T (float), otherwise a loop over std::tanh.
+ */
+template <typename T, bool Vectorized = Eigen::internal::packet_traits<T>::HasTanh>
+struct tanh_n {
+    static void f(const T* x, T* y, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = std::tanh(x[i]);
+        }
+    }
+};
+
+template <typename T>
+struct tanh_n<T, true> {
+    static void f(const T* x, T* y, std::size_t n) {
+        map(y, n) = map(x, n).tanh();
+    }
+};
+
+/* Softplus in the overflow-free form max(x, 0) + log1p(exp(-|x|)).
+ *
+ * Vectorized if Eigen has packet kernels for exp and log1p (float), otherwise
+ * a scalar loop, because a mixed expression would run coefficient-wise anyway.
+ */
+template <typename T, bool Vectorized = Eigen::internal::packet_traits<T>::HasExp && Eigen::internal::packet_traits<T>::HasLog1p>
+struct softplus_n {
+    static void f(const T* x, T* y, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = std::max(x[i], T(0)) + std::log1p(std::exp(-std::abs(x[i])));
+        }
+    }
+};
+
+template <typename T>
+struct softplus_n<T, true> {
+    static void f(const T* x, T* y, std::size_t n) {
+        auto xa = map(x, n);
+        map(y, n) = xa.max(T(0)) + (-xa.abs()).exp().log1p();
+    }
+};
+}
+
 /* Identity function.
  * @T Floating point type which is used for the entire neural network.
  *
@@ -41,6 +137,20 @@ struct identity {
     static constexpr T df(T _x) {
         return 1;
     }
+
+    /* df_y(y) = 1
+     */
+    static constexpr T df_y(T _y) {
+        return 1;
+    }
+
+    static void f1_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
+
+    static void f2_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
 };
 
 /* Sigmoid function.
@@ -67,41 +177,112 @@ struct sigmoid {
     static constexpr T df(T x) {
         return f1(x) * (1 - f1(x));
     }
+
+    /* df_y(y) = y * (1 - y)
+     */
+    static constexpr T df_y(T y) {
+        return y * (1 - y);
+    }
+
+    static void f1_n(const T* x, T* y, std::size_t n) {
+        _::sigmoid_n<T>::f(x, y, n);
+    }
+
+    static void f2_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
 };
 
 /* Softmax function.
  * @T Floating point type which is used for the entire neural network.
  *
  * f(x) = exp(x) / (sum_{i=1}^k exp(x_i))
+ *
+ * All exponentials are shifted by the maximum input (log-sum-exp), so large
+ * inputs do not overflow. f1_n/f2_n need a single exp pass, the scalar f1/f2
+ * track the maximum online.
  */
 template <typename T = double>
 struct softmax {
-    /* f1(x) = exp(x)
+    /* f1(x) = x
      *
-     * Add value to internal sum,
+     * Updates internal maximum and sum of exp(x_i - maximum).
      */
     constexpr T f1(T x) {
-        T y = std::exp(x);
-        sum += y;
-        return y;
+        if (sum == 0.0) {
+            max = x;
+            sum = 1.0;
+        } else if (x > max) {
+            sum = sum * std::exp(max - x) + 1.0;
+            max = x;
+        } else {
+            sum += std::exp(x - max);
+        }
+        return x;
     }
 
-    /* f2(x) = x / sum
+    /* f2(x) = exp(x - maximum) / sum
      */
     constexpr T f2(T x) {
-        return x / sum;
+        return std::exp(x - max) / sum;
     }
 
     /* df(x) = f(x) * (1 - f(x))
      */
     constexpr T df(T x) {
-        T y = std::exp(x) / sum;
+        T y = std::exp(x - max) / sum;
+        return y * (1.0 - y);
+    }
+
+    /* df_y(y) = y * (1 - y)
+     */
+    static constexpr T df_y(T y) {
         return y * (1.0 - y);
     }
 
+    /* y = exp(x - maximum), unlike <f1> this already stores the exponentials.
+     */
+    void f1_n(const T* x, T* y, std::size_t n) {
+        if (n == 0) {
+            return;
+        }
+        max = _::map(x, n).maxCoeff();
+        auto ya = _::map(y, n);
+        ya = (_::map(x, n) - max).exp();
+        sum = ya.sum();
+    }
+
+    /* y = x / sum, to be used on the result of <f1_n>.
+     */
+    void f2_n(const T* x, T* y, std::size_t n) {
+        _::map(y, n) = _::map(x, n) * (1.0 / sum);
+    }
+
+    T max = 0.0;
     T sum = 0.0;
 };
 
+/* Softmax function for the output layer of classifiers, use together with <nntlib::loss::softmax_cross_entropy>.
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * Same forward pass as <softmax>. The derivative is part of the loss, which
+ * directly produces y - t, so df and df_y return 1.
+ */
+template <typename T = double>
+struct softmax_cross_entropy : public softmax<T> {
+    /* df(x) = 1
+     */
+    static constexpr T df(T _x) {
+        return 1.0;
+    }
+
+    /* df_y(y) = 1
+     */
+    static constexpr T df_y(T _y) {
+        return 1.0;
+    }
+};
+
 /* Softplus function.
  * @T Floating point type which is used for the entire neural network.
  *
@@ -126,6 +307,20 @@ struct softplus {
     static constexpr T df(T x) {
         return 1.0 / (1.0 + std::exp(-x));
     }
+
+    /* df_y(y) = 1 - exp(-y)
+     */
+    static constexpr T df_y(T y) {
+        return -std::expm1(-y);
+    }
+
+    static void f1_n(const T* x, T* y, std::size_t n) {
+        _::softplus_n<T>::f(x, y, n);
+    }
+
+    static void f2_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
 };
 
 /* tanh function.
@@ -153,6 +348,20 @@ struct tanh {
         T y = f1(x);
         return 1.0 - y * y;
     }
+
+    /* df_y(y) = 1 - y^2
+     */
+    static constexpr T df_y(T y) {
+        return 1.0 - y * y;
+    }
+
+    static void f1_n(const T* x, T* y, std::size_t n) {
+        _::tanh_n<T>::f(x, y, n);
+    }
+
+    static void f2_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
 };
 
 /* TL function.
@@ -203,6 +412,24 @@ struct tl {
         T y = f1(x);
         return 1.0 - y * y;
     }
+
+    /* df_y(y) = 1 - y^2
+     */
+    static constexpr T df_y(T y) {
+        return 1.0 - y * y;
+    }
+
+    /* Only cheap arithmetic, so this is a plain loop.
+     */
+    static void f1_n(const T* x, T* y, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            y[i] = f1(x[i]);
+        }
+    }
+
+    static void f2_n(const T* x, T* y, std::size_t n) {
+        _::copy_n(x, y, n);
+    }
 };
 
 }
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace nntlib {
+
+/* Contains helpers to run parts of the library on multiple threads.
+ */
+namespace concurrency {
+
+/* Fixed set of worker threads that run the same task with different indices.
+ *
+ * The calling thread participates as worker 0, so a pool of size 1 does not
+ * start any thread at all. Running a task does not allocate memory.
+ */
+class thread_pool {
+    public:
+        /* Creates new pool.
+         * @n_threads Number of threads, including the calling thread.
+         */
+        explicit thread_pool(std::size_t n_threads) : task_fn(nullptr), task_ctx(nullptr), generation(0), pending(0), stop(false) {
+            for (std::size_t i = 1; i < n_threads; ++i) {
+                workers.emplace_back([this, i]{
+                    loop(i);
+                });
+            }
+        }
+
+        thread_pool(const thread_pool& other) = delete;
+        thread_pool(thread_pool&& other) = delete;
+
+        thread_pool& operator=(const thread_pool& other) = delete;
+        thread_pool& operator=(thread_pool&& other) = delete;
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv_start.notify_all();
+            for (auto& t : workers) {
+                t.join();
+            }
+        }
+
+        /* Number of threads, including the calling thread.
+         */
+        std::size_t size() const {
+            return workers.size() + 1;
+        }
+
+        /* Runs func(0), func(1), ..., func(size() - 1) in parallel and waits until all calls are finished.
+         * @Function Function that accepts the worker index.
+         * @func Function object, is called by reference.
+         */
+        template <typename Function>
+        void run(Function& func) {
+            if (workers.empty()) {
+                func(0);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task_fn = [](void* ctx, std::size_t i){
+                    (*static_cast<Function*>(ctx))(i);
+                };
+                task_ctx = &func;
+                pending = workers.size();
+                ++generation;
+            }
+            cv_start.notify_all();
+
+            func(0);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_done.wait(lock, [this]{
+                return pending == 0;
+            });
+        }
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable cv_start;
+        std::condition_variable cv_done;
+        void (*task_fn)(void*, std::size_t);
+        void* task_ctx;
+        std::size_t generation;
+        std::size_t pending;
+        bool stop;
+
+        void loop(std::size_t i) {
+            std::size_t seen = 0;
+            while (true) {
+                void (*fn)(void*, std::size_t);
+                void* ctx;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv_start.wait(lock, [&]{
+                        return stop || (generation != seen);
+                    });
+                    if (stop) {
+                        return;
+                    }
+                    seen = generation;
+                    fn = task_fn;
+                    ctx = task_ctx;
+                }
+
+                fn(ctx, i);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--pending == 0) {
+                        cv_done.notify_one();
+                    }
+                }
+            }
+        }
+};
+
+/* Bounded ring of preallocated slots that are passed from one producer to one consumer.
+ * @T Slot type.
+ *
+ * The producer fills free slots in place and the consumer hands them back
+ * after using them, so no memory gets allocated after construction. Both
+ * sides block if the ring is full respectively empty.
+ */
+template <typename T>
+class ring {
+    public:
+        /* Creates new ring.
+         * @slots Preallocated slots, the number of slots bounds the number of filled slots.
+         */
+        explicit ring(std::vector<T>&& slots) : buffer(std::move(slots)), head(0), n_filled(0), finished(false), closed(false) {}
+
+        ring(const ring& other) = delete;
+        ring(ring&& other) = delete;
+
+        ring& operator=(const ring& other) = delete;
+        ring& operator=(ring&& other) = delete;
+
+        /* Waits for a free slot.
+         * @return Slot that can be filled, nullptr if the ring was closed by the consumer.
+         */
+        T* begin_write() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_free.wait(lock, [this]{
+                return closed || (n_filled < buffer.size());
+            });
+            if (closed) {
+                return nullptr;
+            }
+            return &buffer[(head + n_filled) % buffer.size()];
+        }
+
+        /* Passes the slot returned by <begin_write> to the consumer.
+         */
+        void end_write() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++n_filled;
+            }
+            cv_filled.notify_one();
+        }
+
+        /* Signals that the producer does not fill any more slots.
+         */
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+            }
+            cv_filled.notify_one();
+        }
+
+        /* Waits for a filled slot.
+         * @return Filled slot, nullptr if the producer finished and all slots were consumed.
+         */
+        T* begin_read() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_filled.wait(lock, [this]{
+                return finished || (n_filled > 0);
+            });
+            if (n_filled == 0) {
+                return nullptr;
+            }
+            return &buffer[head];
+        }
+
+        /* Hands the slot returned by <begin_read> back to the producer.
+         */
+        void end_read() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                head = (head + 1) % buffer.size();
+                --n_filled;
+            }
+            cv_free.notify_one();
+        }
+
+        /* Stops the producer, e.g. if the consumer gives up early.
+         */
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            cv_free.notify_one();
+        }
+
+    private:
+        std::vector<T> buffer;
+        std::mutex mutex;
+        std::condition_variable cv_free;
+        std::condition_variable cv_filled;
+        std::size_t head;
+        std::size_t n_filled;
+        bool finished;
+        bool closed;
+};
+
+/* Splits a range into nearly equal, contiguous parts.
+ * @n Size of the range.
+ * @parts Number of parts.
+ * @i Index of the part.
+ * @return Begin (inclusive) and end (exclusive) of part i.
+ */
+inline std::pair<std::size_t, std::size_t> split_range(std::size_t n, std::size_t parts, std::size_t i) {
+    std::size_t chunk = n / parts;
+    std::size_t rest = n % parts;
+    std::size_t first = i * chunk + std::min(i, rest);
+    return std::make_pair(first, first + chunk + (i < rest ? 1 : 0));
+}
+
+}
+}
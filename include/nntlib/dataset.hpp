@@ -0,0 +1,324 @@
+#pragma once
+
+#include "storage.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+
+namespace nntlib {
+
+/* Contains a simple binary dataset format that can be used without parsing.
+ *
+ * A file consists of a 64 byte <header> followed by the payload: one row per
+ * sample, every row consists of the inputs followed by the outputs. All values
+ * are stored in native byte order.
+ */
+namespace dataset {
+
+/* Magic bytes at the beginning of every file.
+ */
+constexpr char magic[4] = {'N', 'N', 'T', 'D'};
+
+/* Current version of the format.
+ */
+constexpr std::uint32_t version = 1;
+
+/* Offset of the payload in bytes, keeps the payload aligned.
+ */
+constexpr std::size_t payload_offset = 64;
+
+/* File header.
+ */
+struct header {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t type;
+    std::uint32_t reserved;
+    std::uint64_t rows;
+    std::uint64_t n_input;
+    std::uint64_t n_output;
+};
+
+static_assert(sizeof(header) <= payload_offset, "Header does not fit in front of the payload!");
+
+/* Random access iterator over the rows of a mapped file, yields <nntlib::storage::row_view> objects.
+ * @T Value type.
+ *
+ * The yielded view is stored within the iterator, so references to it become
+ * invalid as soon as the iterator gets modified.
+ */
+template <typename T>
+class row_iterator {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef std::ptrdiff_t difference_type;
+        typedef nntlib::storage::row_view<const T> value_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        row_iterator() : ptr(nullptr), cols(0), stride(0), current(nullptr, 0) {}
+
+        row_iterator(const T* first, std::size_t row_cols, std::size_t row_stride) : ptr(first), cols(row_cols), stride(row_stride), current(first, row_cols) {}
+
+        reference operator*() const {
+            current = value_type(ptr, cols);
+            return current;
+        }
+
+        pointer operator->() const {
+            return &(**this);
+        }
+
+        value_type operator[](difference_type d) const {
+            return value_type(ptr + d * static_cast<difference_type>(stride), cols);
+        }
+
+        row_iterator& operator++() {
+            ptr += stride;
+            return *this;
+        }
+
+        row_iterator operator++(int) {
+            row_iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        row_iterator& operator--() {
+            ptr -= stride;
+            return *this;
+        }
+
+        row_iterator operator--(int) {
+            row_iterator tmp(*this);
+            --(*this);
+            return tmp;
+        }
+
+        row_iterator& operator+=(difference_type d) {
+            ptr += d * static_cast<difference_type>(stride);
+            return *this;
+        }
+
+        row_iterator& operator-=(difference_type d) {
+            ptr -= d * static_cast<difference_type>(stride);
+            return *this;
+        }
+
+        row_iterator operator+(difference_type d) const {
+            return row_iterator(*this) += d;
+        }
+
+        row_iterator operator-(difference_type d) const {
+            return row_iterator(*this) -= d;
+        }
+
+        difference_type operator-(const row_iterator& other) const {
+            return (this->ptr - other.ptr) / static_cast<difference_type>(stride);
+        }
+
+        bool operator==(const row_iterator& other) const {
+            return this->ptr == other.ptr;
+        }
+
+        bool operator!=(const row_iterator& other) const {
+            return this->ptr != other.ptr;
+        }
+
+        bool operator<(const row_iterator& other) const {
+            return this->ptr < other.ptr;
+        }
+
+        bool operator>(const row_iterator& other) const {
+            return this->ptr > other.ptr;
+        }
+
+        bool operator<=(const row_iterator& other) const {
+            return this->ptr <= other.ptr;
+        }
+
+        bool operator>=(const row_iterator& other) const {
+            return this->ptr >= other.ptr;
+        }
+
+    private:
+        const T* ptr;
+        std::size_t cols;
+        std::size_t stride;
+        mutable value_type current;
+};
+
+template <typename T>
+row_iterator<T> operator+(typename row_iterator<T>::difference_type d, const row_iterator<T>& it) {
+    return it + d;
+}
+
+/* Read-only, memory mapped dataset file.
+ * @T Value type, must match the type of the file.
+ *
+ * The file is mapped as a whole and shared with the OS page cache, so opening
+ * is cheap and multiple processes can use the same file without copies.
+ * Inputs and outputs can be passed directly to the trainers:
+ *
+ * trainer.train(net, data.x_begin(), data.x_end(), data.y_begin(), data.y_end());
+ */
+template <typename T>
+class mapped {
+    public:
+        typedef row_iterator<T> iterator;
+
+        /* Maps a file.
+         * @path Path of the file.
+         *
+         * Throws std::system_error if the file cannot be mapped and std::runtime_error if it is not a valid dataset.
+         */
+        explicit mapped(const std::string& path) : file(path) {
+            if (file.size() < payload_offset) {
+                throw std::runtime_error(path + " is not a dataset (too short)");
+            }
+            check(path);
+        }
+
+        mapped(const mapped& other) = delete;
+        mapped(mapped&& other) = default;
+
+        mapped& operator=(const mapped& other) = delete;
+        mapped& operator=(mapped&& other) = delete;
+
+        /* Number of samples.
+         */
+        std::size_t rows() const {
+            return static_cast<std::size_t>(head.rows);
+        }
+
+        std::size_t size_in() const {
+            return static_cast<std::size_t>(head.n_input);
+        }
+
+        std::size_t size_out() const {
+            return static_cast<std::size_t>(head.n_output);
+        }
+
+        iterator x_begin() const {
+            return iterator(payload(), size_in(), stride());
+        }
+
+        iterator x_end() const {
+            return iterator(payload() + rows() * stride(), size_in(), stride());
+        }
+
+        iterator y_begin() const {
+            return iterator(payload() + size_in(), size_out(), stride());
+        }
+
+        iterator y_end() const {
+            return iterator(payload() + size_in() + rows() * stride(), size_out(), stride());
+        }
+
+    private:
+        nntlib::storage::mapped_file file;
+        header head;
+
+        const T* payload() const {
+            return reinterpret_cast<const T*>(file.data() + payload_offset);
+        }
+
+        std::size_t stride() const {
+            return size_in() + size_out();
+        }
+
+        void check(const std::string& path) {
+            std::memcpy(&head, file.data(), sizeof(header));
+
+            if (std::memcmp(head.magic, magic, sizeof(magic)) != 0) {
+                throw std::runtime_error(path + " is not a dataset (wrong magic)");
+            }
+            if (head.version != version) {
+                throw std::runtime_error(path + " has unsupported version " + std::to_string(head.version));
+            }
+            if (head.type != static_cast<std::uint32_t>(nntlib::storage::dtype_of<T>::value)) {
+                throw std::runtime_error(path + " has a different value type");
+            }
+            if (head.n_input + head.n_output == 0) {
+                throw std::runtime_error(path + " has samples without any values");
+            }
+            if ((file.size() - payload_offset) / sizeof(T) / (head.n_input + head.n_output) < head.rows) {
+                throw std::runtime_error(path + " is truncated");
+            }
+        }
+};
+
+/* Writes a dataset file.
+ * @T Value type of the file.
+ * @path Path of the file, gets overwritten.
+ * @n_input Number of inputs per sample.
+ * @n_output Number of outputs per sample.
+ * @x_first Begin of the inputs, must yield containers.
+ * @x_last End of the inputs.
+ * @y_first Begin of the outputs, must yield containers.
+ * @y_last End of the outputs.
+ *
+ * Missing elements are set to zero, surplus elements are ignored. Throws
+ * std::runtime_error if samples would have no values at all (n_input +
+ * n_output == 0) and std::system_error if the file cannot be written.
+ */
+template <typename T, typename InputIt1, typename InputIt2>
+void write(const std::string& path, std::size_t n_input, std::size_t n_output, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+    if (n_input + n_output == 0) {
+        throw std::runtime_error("cannot write " + path + ": samples without any values");
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+    }
+
+    header head{};
+    std::memcpy(head.magic, magic, sizeof(magic));
+    head.version = version;
+    head.type = static_cast<std::uint32_t>(nntlib::storage::dtype_of<T>::value);
+    head.n_input = n_input;
+    head.n_output = n_output;
+
+    // header gets written again as soon as the number of rows is known
+    char padding[payload_offset] = {};
+    out.write(padding, payload_offset);
+
+    std::vector<T> row(n_input + n_output);
+    auto fill = [](auto first, auto last, T* dest, std::size_t n) {
+        std::size_t i = 0;
+        for (; (first != last) && (i < n); ++first) {
+            dest[i++] = static_cast<T>(*first);
+        }
+        std::fill(dest + i, dest + n, T(0));
+    };
+    while ((x_first != x_last) && (y_first != y_last)) {
+        fill(x_first->begin(), x_first->end(), row.data(), n_input);
+        fill(y_first->begin(), y_first->end(), row.data() + n_input, n_output);
+        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(T)));
+        ++head.rows;
+
+        ++x_first;
+        ++y_first;
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&head), sizeof(header));
+    out.flush();
+    if (!out) {
+        throw std::system_error(errno, std::generic_category(), "cannot write " + path);
+    }
+}
+
+}
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+
+/* Instrumentation is opt-in: define NNTLIB_INSTRUMENTATION before including
+ * any nntlib header (e.g. -DNNTLIB_INSTRUMENTATION) to enable it. Otherwise
+ * all instrumentation points expand to nothing.
+ */
+#ifdef NNTLIB_INSTRUMENTATION
+#define NNTLIB_INSTRUMENT_SCOPE(stats, index, layer, kind, samples) \
+    nntlib::instrumentation::scope nntlib_instrumentation_scope((stats), (index), (layer), nntlib::instrumentation::kind_t::kind, (samples))
+#define NNTLIB_INSTRUMENT_ALLOCATION(bytes) \
+    nntlib::instrumentation::record_allocation(bytes)
+#define NNTLIB_INSTRUMENT_FLOPS(flops) \
+    nntlib::instrumentation::record_flops(flops)
+#else
+#define NNTLIB_INSTRUMENT_SCOPE(stats, index, layer, kind, samples)
+#define NNTLIB_INSTRUMENT_ALLOCATION(bytes)
+#define NNTLIB_INSTRUMENT_FLOPS(flops)
+#endif
+
+
+namespace nntlib {
+
+/* Contains per-layer counters of the net operations.
+ *
+ * Every net owns its <counters> (shared with its copies, see <handle>), indexed by the
+ * position of the layer within the net, so nets that are used at the same time
+ * do not mix up their numbers. All counters are updated atomically, so they
+ * also work with multi-threaded training. Read them using
+ * net.instrumentation().snapshot(), e.g. from the round or batch callback of a
+ * trainer.
+ *
+ * FLOPs get estimated using the number of weights. Layers that do less work
+ * (e.g. sparse or quantized layers) provide std::size_t flops(std::size_t
+ * n_samples) const, the operations of a forward pass over n samples. Costs
+ * that depend on the input (e.g. the active inputs of
+ * <nntlib::layer::sparse_input>) get added by the layer itself during the
+ * operation, see NNTLIB_INSTRUMENT_FLOPS.
+ */
+namespace instrumentation {
+
+/* True if the library was compiled with NNTLIB_INSTRUMENTATION, otherwise all counters stay empty.
+ */
+#ifdef NNTLIB_INSTRUMENTATION
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+/* Maximum number of layers per net that get recorded.
+ */
+constexpr std::size_t max_layers = 64;
+
+enum class kind_t {
+    forward = 0,
+    backward = 1,
+    update = 2,
+    allocate = 3
+};
+
+/* Counters of a single layer.
+ */
+struct layer_stats {
+    /* Name of the layer type as returned by typeid, nullptr if the layer was never used.
+     */
+    const char* name;
+    std::uint64_t forward_ns;
+    std::uint64_t backward_ns;
+    std::uint64_t update_ns;
+    std::uint64_t forward_calls;
+    std::uint64_t backward_calls;
+    std::uint64_t update_calls;
+
+    /* Operations of forward and backward passes and updates, estimated using the number of weights or the flops method of the layer.
+     */
+    std::uint64_t flops;
+
+    /* Number of samples processed by the forward pass (including the forward part of training).
+     */
+    std::uint64_t samples;
+
+    /* Bytes allocated through <nntlib::storage::aligned_allocator> (e.g. weights, states, batch blocks).
+     */
+    std::uint64_t bytes_allocated;
+};
+
+/* Private implementation details.
+ */
+namespace _ {
+struct layer_counters {
+    std::atomic<const char*> name;
+    std::atomic<std::uint64_t> ns[4];
+    std::atomic<std::uint64_t> calls[4];
+    std::atomic<std::uint64_t> flops;
+    std::atomic<std::uint64_t> samples;
+    std::atomic<std::uint64_t> bytes_allocated;
+};
+
+/* Counters of the layer that is currently processed by this thread, nullptr if there is none.
+ */
+inline layer_counters*& current_layer() {
+    static thread_local layer_counters* current = nullptr;
+    return current;
+}
+
+template <typename Layer>
+auto weight_count(const Layer& layer, int) -> decltype(layer.get_weights().rows() * layer.get_weights().cols()) {
+    return layer.get_weights().rows() * layer.get_weights().cols();
+}
+
+template <typename Layer>
+std::size_t weight_count(const Layer& _layer, long) {
+    return 0;
+}
+
+/* Operations of a forward pass over n samples, one multiply-add per weight unless the layer provides its own estimate.
+ */
+template <typename Layer>
+auto forward_flops(const Layer& layer, std::size_t n_samples, int) -> decltype(static_cast<std::uint64_t>(layer.flops(n_samples))) {
+    return static_cast<std::uint64_t>(layer.flops(n_samples));
+}
+
+template <typename Layer>
+std::uint64_t forward_flops(const Layer& layer, std::size_t n_samples, long) {
+    return 2 * static_cast<std::uint64_t>(weight_count(layer, 0)) * n_samples;
+}
+}
+
+/* Per-layer counters of one net.
+ *
+ * Stays empty if the library was compiled without NNTLIB_INSTRUMENTATION.
+ */
+class counters {
+    public:
+        counters() {
+            reset();
+        }
+
+        counters(const counters& other) = delete;
+        counters(counters&& other) = delete;
+
+        counters& operator=(const counters& other) = delete;
+        counters& operator=(counters&& other) = delete;
+
+        /* Returns the counters of all layers that were used since the last <reset>.
+         */
+        std::vector<layer_stats> snapshot() const {
+            std::vector<layer_stats> result;
+            for (const auto& c : layers) {
+                const char* name = c.name.load(std::memory_order_relaxed);
+                if (name == nullptr) {
+                    break;
+                }
+
+                result.push_back(layer_stats{
+                    name,
+                    c.ns[0].load(std::memory_order_relaxed),
+                    c.ns[1].load(std::memory_order_relaxed),
+                    c.ns[2].load(std::memory_order_relaxed),
+                    c.calls[0].load(std::memory_order_relaxed),
+                    c.calls[1].load(std::memory_order_relaxed),
+                    c.calls[2].load(std::memory_order_relaxed),
+                    c.flops.load(std::memory_order_relaxed),
+                    c.samples.load(std::memory_order_relaxed),
+                    c.bytes_allocated.load(std::memory_order_relaxed)
+                });
+            }
+            return result;
+        }
+
+        /* Sets all counters to zero.
+         */
+        void reset() {
+            for (auto& c : layers) {
+                c.name.store(nullptr, std::memory_order_relaxed);
+                for (std::size_t k = 0; k < 4; ++k) {
+                    c.ns[k].store(0, std::memory_order_relaxed);
+                    c.calls[k].store(0, std::memory_order_relaxed);
+                }
+                c.flops.store(0, std::memory_order_relaxed);
+                c.samples.store(0, std::memory_order_relaxed);
+                c.bytes_allocated.store(0, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        friend class scope;
+
+        std::array<_::layer_counters, enabled ? max_layers : 0> layers;
+};
+
+/* Shared reference to the <counters> of a net, copies refer to the same counters.
+ *
+ * Allocates the counters if the library was compiled with
+ * NNTLIB_INSTRUMENTATION. Otherwise it is an empty class (nets use it as base
+ * class, so it does not take any space) that refers to a static, empty
+ * instance.
+ */
+#ifdef NNTLIB_INSTRUMENTATION
+class handle {
+    public:
+        handle() : ptr(std::make_shared<counters>()) {}
+
+        counters& get() const {
+            return *ptr;
+        }
+
+    private:
+        std::shared_ptr<counters> ptr;
+};
+#else
+class handle {
+    public:
+        counters& get() const {
+            static counters empty;
+            return empty;
+        }
+};
+#endif
+
+/* Records the runtime of one layer operation, see NNTLIB_INSTRUMENT_SCOPE.
+ */
+class scope {
+    public:
+        template <typename Layer>
+        scope(counters& stats, std::size_t layer_index, const Layer& layer, kind_t op, std::size_t n_samples) : current((layer_index < stats.layers.size()) ? &stats.layers[layer_index] : nullptr), previous(_::current_layer()), kind(op), start(std::chrono::steady_clock::now()) {
+            if (current == nullptr) {
+                return;
+            }
+
+            auto& c = *current;
+            c.name.store(typeid(Layer).name(), std::memory_order_relaxed);
+
+            std::uint64_t flops = 0;
+            switch (kind) {
+                case kind_t::forward:
+                    c.samples.fetch_add(n_samples, std::memory_order_relaxed);
+                    flops = _::forward_flops(layer, n_samples, 0);
+                    break;
+                case kind_t::backward:
+                    // gradient and error of the previous layer
+                    flops = 2 * _::forward_flops(layer, n_samples, 0);
+                    break;
+                case kind_t::update:
+                    // one addition per weight
+                    flops = _::forward_flops(layer, 1, 0) / 2;
+                    break;
+                case kind_t::allocate:
+                    break;
+            }
+            c.flops.fetch_add(flops, std::memory_order_relaxed);
+
+            _::current_layer() = current;
+        }
+
+        scope(const scope& other) = delete;
+        scope(scope&& other) = delete;
+
+        scope& operator=(const scope& other) = delete;
+        scope& operator=(scope&& other) = delete;
+
+        ~scope() {
+            _::current_layer() = previous;
+            if (current == nullptr) {
+                return;
+            }
+
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            auto& c = *current;
+            c.ns[static_cast<std::size_t>(kind)].fetch_add(static_cast<std::uint64_t>(ns), std::memory_order_relaxed);
+            c.calls[static_cast<std::size_t>(kind)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        _::layer_counters* current;
+        _::layer_counters* previous;
+        kind_t kind;
+        std::chrono::steady_clock::time_point start;
+};
+
+/* Attributes an allocation to the layer that is currently processed by this thread.
+ */
+inline void record_allocation(std::size_t bytes) {
+    _::layer_counters* current = _::current_layer();
+    if (current != nullptr) {
+        current->bytes_allocated.fetch_add(bytes, std::memory_order_relaxed);
+    }
+}
+
+/* Adds operations to the layer that is currently processed by this thread, used by layers whose costs depend on the input.
+ */
+inline void record_flops(std::uint64_t flops) {
+    _::layer_counters* current = _::current_layer();
+    if (current != nullptr) {
+        current->flops.fetch_add(flops, std::memory_order_relaxed);
+    }
+}
+
+}
+}
@@ -2,9 +2,14 @@
 
 #include "utils.hpp"
 
+#include <array>
+#include <cstddef>
 #include <iterator>
 #include <memory>
+#include <new>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace nntlib {
@@ -276,12 +281,224 @@ class combine {
         _::combine_container<T> container;
 };
 
+namespace _ {
+template <typename T, typename Tuple, std::size_t I>
+T& combine_static_deref(const Tuple& iters) {
+    return *std::get<I>(iters);
+}
+
+/* Dereferences the i-th iterator of a tuple using a table of function pointers (no virtual calls).
+ */
+template <typename T, typename Tuple, std::size_t... Is>
+T& combine_static_get(const Tuple& iters, std::size_t i, std::index_sequence<Is...>) {
+    static constexpr T& (*const table[])(const Tuple&) = {&combine_static_deref<T, Tuple, Is>...};
+    return table[i](iters);
+}
+
+template <typename Row>
+class combine_static_mapper {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename Row::value_type value_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        combine_static_mapper(const Row* parent, std::size_t internal_pos) : row(parent), pos(internal_pos) {}
+
+        combine_static_mapper& operator++() {
+            ++pos;
+            return *this;
+        }
+
+        reference operator*() const {
+            return (*row)[pos];
+        }
+
+        pointer operator->() const {
+            return &(*row)[pos];
+        }
+
+        bool operator==(const combine_static_mapper& other) const {
+            return this->pos == other.pos;
+        }
+
+        bool operator!=(const combine_static_mapper& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const Row* row;
+        std::size_t pos;
+};
+
+/* Storage of combined iterators of different types, uses a tuple.
+ */
+template <typename T, bool Same, typename... Iters>
+class combine_static_storage {
+    public:
+        combine_static_storage(Iters... its) : iters(its...) {}
+
+        T& get(std::size_t i) const {
+            return combine_static_get<T>(iters, i, std::index_sequence_for<Iters...>{});
+        }
+
+        void incr_all() {
+            nntlib::utils::tuple_apply(iters, [](auto& it){
+                ++it;
+            });
+        }
+
+        bool eq(const combine_static_storage& other) const {
+            return this->iters == other.iters;
+        }
+
+    private:
+        std::tuple<Iters...> iters;
+};
+
+/* Storage of combined iterators of the same type, uses an array so indexing does not need any dispatch.
+ */
+template <typename T, typename Iter, typename... Iters>
+class combine_static_storage<T, true, Iter, Iters...> {
+    public:
+        combine_static_storage(Iter it, Iters... its) : iters{{it, its...}} {}
+
+        T& get(std::size_t i) const {
+            return *iters[i];
+        }
+
+        void incr_all() {
+            for (auto& it : iters) {
+                ++it;
+            }
+        }
+
+        bool eq(const combine_static_storage& other) const {
+            return this->iters == other.iters;
+        }
+
+    private:
+        std::array<Iter, 1 + sizeof...(Iters)> iters;
+};
+
+template <typename T, typename IterHead, typename... IterTail>
+class combine_static_row {
+    public:
+        typedef T value_type;
+        typedef combine_static_mapper<combine_static_row> iterator;
+
+        combine_static_row(IterHead head, IterTail... tail) : storage(head, tail...) {}
+
+        static constexpr std::size_t size() {
+            return 1 + sizeof...(IterTail);
+        }
+
+        iterator begin() const {
+            return iterator(this, 0);
+        }
+
+        iterator end() const {
+            return iterator(this, size());
+        }
+
+        T& operator[](std::size_t i) const {
+            return storage.get(i);
+        }
+
+        void incr_all() {
+            storage.incr_all();
+        }
+
+        bool eq(const combine_static_row& other) const {
+            return this->storage.eq(other.storage);
+        }
+
+    private:
+        combine_static_storage<T, nntlib::utils::all_same<IterHead, IterTail...>::value, IterHead, IterTail...> storage;
+};
+}
+
+/* Combines a fixed set of iterators (=columns) to one iterator (=rows).
+ * @T Value type of all iterators.
+ * @Iters Types of the combined iterators.
+ *
+ * Same semantics as <combine>, but the iterators are stored in a tuple, so
+ * neither increments nor copies allocate memory and there are no virtual
+ * calls. Accessing a column by index is a plain array access if all
+ * iterators have the same type and uses a table of function pointers otherwise.
+ * Use <make_combine> to create it.
+ */
+template <typename T, typename... Iters>
+class combine_static {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::ptrdiff_t difference_type;
+        typedef _::combine_static_row<T, Iters...> value_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        /* Constructs new combined iterator.
+         */
+        combine_static(Iters... iters) : row(iters...) {}
+
+        /* Increments all containing iterators.
+         *
+         * @return reference to self.
+         */
+        combine_static& operator++() {
+            row.incr_all();
+            return *this;
+        }
+
+        /* Yields a container reference that containes the current state of all iterators.
+         */
+        reference operator*() const {
+            return row;
+        }
+
+        /* Yields a container pointer that containes the current state of all iterators.
+         */
+        pointer operator->() const {
+            return &row;
+        }
+
+        /* Checks for equality, true iff all iterators are pairwise equal.
+         */
+        bool operator==(const combine_static& other) const {
+            return this->row.eq(other.row);
+        }
+
+        /* Checks for inequality.
+         */
+        bool operator!=(const combine_static& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        value_type row;
+};
+
+/* Creates new <combine_static> iterator, the value type is taken from the first iterator.
+ */
+template <
+    typename IterHead,
+    typename... IterTail,
+    typename T = typename std::remove_reference<decltype(*std::declval<IterHead>())>::type
+>
+combine_static<T, IterHead, IterTail...> make_combine(IterHead head, IterTail... tail) {
+    return combine_static<T, IterHead, IterTail...>(head, tail...);
+}
+
 /* Transform the results of one iterator using a function
  * @Iter source iterator.
  * @Function function that maps *iter -> Target:
  * @Target return type of the function.
  * @IteratorTag Iterator tag of the iterator.
  * @CleanupPointers if Function returns pointers, should we delete them?
+ *
+ * Results that are returned by value are stored within the iterator, so
+ * dereferencing does not allocate memory.
  */
 template <typename Iter, typename Function, typename Target, bool CleanupPointers, typename IteratorTag>
 struct transform;
@@ -298,6 +515,10 @@ struct transform<Iter, Function, Target, CleanupPointers, nntlib::utils::undef>
     Function function;
     mutable Target* current;
 
+    /* Inline storage for results that are returned by value, so dereferencing never allocates.
+     */
+    mutable typename std::aligned_storage<sizeof(Target), alignof(Target)>::type buffer;
+
     /* Creates new transform iterator using a underlying iterator and a function.
      * @i Iterator copy.
      * @f Funciton copy.
@@ -305,8 +526,8 @@ struct transform<Iter, Function, Target, CleanupPointers, nntlib::utils::undef>
     transform(Iter i, Function f) : iter(i), function(f), current(nullptr) {}
 
     transform(const transform& other) : iter(other.iter), function(other.function), current(nullptr) {}
-    transform(transform&& other) : iter(other.iter), function(other.function), current(other.current) {
-        other.current = nullptr;
+    transform(transform&& other) : iter(other.iter), function(other.function), current(nullptr) {
+        steal<fresult_t>(other);
     }
 
     ~transform() {
@@ -334,9 +555,9 @@ struct transform<Iter, Function, Target, CleanupPointers, nntlib::utils::undef>
 
         iter = other.iter;
         function = other.function;
-        current = other.current;
+        current = nullptr;
 
-        other.current = nullptr;
+        steal<fresult_t>(other);
 
         return *this;
     }
@@ -386,7 +607,24 @@ struct transform<Iter, Function, Target, CleanupPointers, nntlib::utils::undef>
     template <typename F>
     typename std::enable_if<!std::is_pointer<F>::value && !std::is_reference<F>::value>::type
     update_current() const {
-        current = new Target(function(*iter));
+        current = new (&buffer) Target(function(*iter));
+    }
+
+    /* Takes over the current result of another iterator, results in the inline storage are recalculated instead.
+     */
+    template <typename F>
+    typename std::enable_if<std::is_pointer<F>::value || std::is_reference<F>::value>::type
+    steal(transform& other) {
+        current = other.current;
+        other.current = nullptr;
+    }
+
+    template <typename F>
+    typename std::enable_if<!std::is_pointer<F>::value && !std::is_reference<F>::value>::type
+    steal(transform& other) {
+        if (other.current != nullptr) {
+            other.template cleanup<F, CleanupPointers>();
+        }
     }
 
     template <typename F, bool P>
@@ -411,7 +649,7 @@ struct transform<Iter, Function, Target, CleanupPointers, nntlib::utils::undef>
     template <typename F, bool P>
     typename std::enable_if<!std::is_pointer<F>::value && !std::is_reference<F>::value>::type
     cleanup() {
-        delete current;
+        current->~Target();
         current = nullptr;
     }
 };
@@ -1,11 +1,21 @@
 #pragma once
 
+#include "storage.hpp"
 #include "utils.hpp"
 
+#if defined(__AVX2__) || defined(__AVX512VNNI__)
+#include <immintrin.h>
+#endif
+
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <random>
+#include <stdexcept>
+#include <type_traits>
 
 
 namespace nntlib {
@@ -16,6 +26,331 @@ namespace nntlib {
  */
 namespace layer {
 
+/* Private implementation details.
+ */
+namespace _ {
+/* Applies an activation to an entire state vector, using its vectorized
+ * f1_n/f2_n if available and the scalar f1/f2 otherwise.
+ */
+template <typename Activation, typename T>
+auto activate(Activation& activation, T* y, std::size_t n, int) -> decltype(activation.f1_n(y, y, n), activation.f2_n(y, y, n), void()) {
+    activation.f1_n(y, y, n);
+    activation.f2_n(y, y, n);
+}
+
+template <typename Activation, typename T>
+void activate(Activation& activation, T* y, std::size_t n, long) {
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i] = activation.f1(y[i]);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i] = activation.f2(y[i]);
+    }
+}
+
+template <typename Activation, typename T>
+void activate(Activation& activation, T* y, std::size_t n) {
+    activate(activation, y, n, 0);
+}
+
+/* Applies an activation to the first n columns of a block.
+ *
+ * Activations without members are applied row by row to use the contiguous
+ * memory, all others (e.g. softmax) get one object per sample.
+ */
+template <typename Activation, typename Block>
+void activate_block(Block& block, std::size_t n, std::true_type _stateless) {
+    Activation activation;
+    for (auto& row : block) {
+        activate(activation, row.data(), n);
+    }
+}
+
+template <typename Activation, typename Block>
+void activate_block(Block& block, std::size_t n, std::false_type _stateless) {
+    typedef typename Block::value_type T;
+
+    // columns are strided, so copy them into the column buffer of the block (see <nntlib::storage::batch_matrix>) to use the vectorized functions
+    auto y = nntlib::storage::as_eigen(block, n);
+    Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1>> column(block.column.data(), static_cast<Eigen::Index>(block.rows()));
+    for (std::size_t b = 0; b < n; ++b) {
+        Activation activation;
+        column = y.col(b);
+        activate(activation, column.data(), block.rows());
+        y.col(b) = column;
+    }
+}
+
+/* Implementation of fully connected layers that is shared between the
+ * different weight storages. Every row of the weights consists of the bias
+ * followed by the input weights. The weights might use a different value type
+ * than the gradient, calculations happen in the type of the gradient.
+ */
+template <typename Activation, typename Weights, typename InputIt, typename State, typename PrevError, typename Error, typename Gradient>
+void fc_backward(const Weights& weights, InputIt x_first, InputIt x_last, const State& y, const PrevError& prev_error, Error& error_mem, Gradient& gradient, Activation& activation) {
+    typedef typename Gradient::value_type T;
+
+    std::fill(error_mem.begin(), error_mem.end(), 0.0);
+
+    for (std::size_t j = 0; j < weights.rows(); ++j) {
+        T de_doj = prev_error[j];
+        T doj_dnetj = activation.df_y(y[j]);
+        T dj = de_doj * doj_dnetj;
+
+        auto gradientj = gradient[j];
+        gradientj[0] = dj;
+        std::transform(x_first, x_last, std::next(gradientj.begin()), [&](T xi){
+            return dj * xi;
+        });
+
+        const auto* wj = weights[j].data() + 1;
+        for (std::size_t i = 0; i < error_mem.size(); ++i) {
+            error_mem[i] += dj * static_cast<T>(wj[i]);
+        }
+    }
+}
+
+template <typename Activation, typename Weights, typename Block>
+void fc_forward_batch(const Weights& weights, const nntlib::storage::row_matrix<typename Weights::value_type>& x, std::size_t n, Block& state) {
+    auto w = nntlib::storage::as_eigen(weights);
+    auto y = nntlib::storage::as_eigen(state, n);
+
+    y.noalias() = w.rightCols(weights.cols() - 1) * nntlib::storage::as_eigen(x, n);
+    y.colwise() += w.col(0);
+
+    activate_block<Activation>(state, n, typename std::is_empty<Activation>::type{});
+}
+
+template <typename Activation, typename Weights, typename Block>
+void fc_backward_batch(const Weights& weights, const nntlib::storage::row_matrix<typename Weights::value_type>& x, std::size_t n, const Block& state, nntlib::storage::row_matrix<typename Weights::value_type>& prev_error, nntlib::storage::row_matrix<typename Weights::value_type>& error_mem, Weights& gradient) {
+    typedef typename Weights::value_type T;
+
+    for (std::size_t j = 0; j < weights.rows(); ++j) {
+        const T* yj = state[j].data();
+        T* dj = prev_error[j].data();
+        for (std::size_t b = 0; b < n; ++b) {
+            dj[b] *= Activation::df_y(yj[b]);
+        }
+    }
+
+    auto d = nntlib::storage::as_eigen(prev_error, n);
+    auto w = nntlib::storage::as_eigen(weights);
+    auto g = nntlib::storage::as_eigen(gradient);
+    const std::size_t n_input = weights.cols() - 1;
+
+    // the gradient gets summed up within the product
+    g.col(0) = d.rowwise().sum();
+    g.rightCols(n_input).noalias() = d * nntlib::storage::as_eigen(x, n).transpose();
+    nntlib::storage::as_eigen(error_mem, n).noalias() = w.rightCols(n_input).transpose() * d;
+}
+
+/* Like <fc_forward_batch>, but for weights stored in a different (e.g. smaller) type than the compute type T.
+ *
+ * Every weight gets converted once per block and accumulated in T, row by row
+ * of the input block, so the inner loops run over contiguous samples.
+ */
+template <typename Activation, typename T, typename Weights, typename Block>
+void fc_forward_batch_mixed(const Weights& weights, const nntlib::storage::row_matrix<T>& x, std::size_t n, Block& state) {
+    const std::size_t n_input = weights.cols() - 1;
+
+    for (std::size_t j = 0; j < weights.rows(); ++j) {
+        const auto* wj = weights[j].data();
+        T* yj = state[j].data();
+        std::fill_n(yj, n, static_cast<T>(wj[0]));
+        for (std::size_t i = 0; i < n_input; ++i) {
+            const T wji = static_cast<T>(wj[i + 1]);
+            const T* xi = x[i].data();
+            for (std::size_t b = 0; b < n; ++b) {
+                yj[b] += wji * xi[b];
+            }
+        }
+    }
+
+    activate_block<Activation>(state, n, typename std::is_empty<Activation>::type{});
+}
+
+/* Like <fc_backward_batch>, but for weights stored in a different type than the compute type T. The gradient uses T.
+ */
+template <typename Activation, typename T, typename Weights, typename Block>
+void fc_backward_batch_mixed(const Weights& weights, const nntlib::storage::row_matrix<T>& x, std::size_t n, const Block& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& error_mem, nntlib::storage::row_matrix<T>& gradient) {
+    const std::size_t n_input = weights.cols() - 1;
+
+    for (std::size_t i = 0; i < n_input; ++i) {
+        std::fill_n(error_mem[i].data(), n, T(0));
+    }
+
+    for (std::size_t j = 0; j < weights.rows(); ++j) {
+        const T* yj = state[j].data();
+        T* dj = prev_error[j].data();
+        T bias = 0;
+        for (std::size_t b = 0; b < n; ++b) {
+            dj[b] *= Activation::df_y(yj[b]);
+            bias += dj[b];
+        }
+
+        const auto* wj = weights[j].data();
+        T* gj = gradient[j].data();
+        gj[0] = bias;
+        for (std::size_t i = 0; i < n_input; ++i) {
+            const T wji = static_cast<T>(wj[i + 1]);
+            const T* xi = x[i].data();
+            T* ei = error_mem[i].data();
+            T gji = 0;
+            for (std::size_t b = 0; b < n; ++b) {
+                gji += dj[b] * xi[b];
+                ei[b] += wji * dj[b];
+            }
+            gj[i + 1] = gji;
+        }
+    }
+}
+
+/* Adds a delta to weights.
+ *
+ * Both matrices share the same layout and zero padding, so this runs over the entire buffer.
+ */
+template <typename Weights>
+void add_buffer(Weights& weights, const Weights& delta) {
+    typedef typename Weights::value_type T;
+
+    T* w = weights.data();
+    const T* d = delta.data();
+    const std::size_t n = weights.buffer_size();
+    for (std::size_t i = 0; i < n; ++i) {
+        w[i] += d[i];
+    }
+}
+
+/* Calculates bias + <w, x> in the compute type T, the weights might use a different storage type.
+ */
+template <typename T, typename Storage, typename InputIt>
+T netj_mixed(const Storage* w, std::size_t n, InputIt x_first, InputIt x_last, std::input_iterator_tag) {
+    T netj = static_cast<T>(w[0]);
+    std::size_t k = 1;
+    for (; (x_first != x_last) && (k < n); ++x_first) {
+        netj += (*x_first) * static_cast<T>(w[k]);
+        ++k;
+    }
+    return netj;
+}
+
+/* Random access version with a fixed trip count, so the loop can be vectorized.
+ */
+template <typename T, typename Storage, typename InputIt>
+T netj_mixed(const Storage* w, std::size_t n, InputIt x_first, InputIt x_last, std::random_access_iterator_tag) {
+    const std::size_t m = std::min(n - 1, static_cast<std::size_t>(x_last - x_first));
+    T netj = static_cast<T>(w[0]);
+    for (std::size_t i = 0; i < m; ++i) {
+        netj += x_first[i] * static_cast<T>(w[i + 1]);
+    }
+    return netj;
+}
+
+/* Dot product of unsigned and signed 8 bit integers with 32 bit accumulation.
+ * @x Unsigned values, must be aligned to 64 bytes and must not exceed 127.
+ * @w Signed values, must be aligned to 64 bytes.
+ * @n Number of elements, must be a multiple of 64.
+ *
+ * Uses VNNI or AVX2 if enabled at compile time. The limit of x makes sure that
+ * the pairwise sums of the AVX2 path do not saturate.
+ */
+inline std::int32_t dot_u8s8(const std::uint8_t* x, const std::int8_t* w, std::size_t n) {
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    __m512i acc = _mm512_setzero_si512();
+    for (std::size_t i = 0; i < n; i += 64) {
+        acc = _mm512_dpbusd_epi32(acc, _mm512_load_si512(x + i), _mm512_load_si512(w + i));
+    }
+    return _mm512_reduce_add_epi32(acc);
+#elif defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for (std::size_t i = 0; i < n; i += 32) {
+        __m256i xi = _mm256_load_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i wi = _mm256_load_si256(reinterpret_cast<const __m256i*>(w + i));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(xi, wi), ones));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return _mm_cvtsi128_si32(sum);
+#else
+    std::int32_t acc = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        acc += static_cast<std::int32_t>(x[i]) * static_cast<std::int32_t>(w[i]);
+    }
+    return acc;
+#endif
+}
+
+/* Builds a pruning mask (1 = keep, 0 = pruned) for row matrix weights.
+ * @weights Weights, one row (bias followed by input weights) per output.
+ * @sparsity Fraction of the input weights with the smallest magnitudes to prune, within [0, 1]. Biases are never pruned.
+ * @mask Output, has the same layout as the weights (including zero padding).
+ */
+template <typename Weights, typename Mask>
+void prune_mask(const Weights& weights, double sparsity, Mask& mask) {
+    typedef typename Weights::value_type T;
+
+    if (!(sparsity >= 0.0 && sparsity <= 1.0)) {
+        throw std::invalid_argument("sparsity has to be within [0, 1]");
+    }
+
+    std::vector<T> magnitudes;
+    magnitudes.reserve(weights.rows() * (weights.cols() - 1));
+    for (const auto& wj : weights) {
+        for (std::size_t i = 1; i < wj.size(); ++i) {
+            magnitudes.push_back(std::abs(static_cast<T>(wj[i])));
+        }
+    }
+    std::size_t n_prune = static_cast<std::size_t>(sparsity * static_cast<double>(magnitudes.size()) + 0.5);
+
+    // everything below the threshold gets pruned, ties only until n_prune is reached
+    T threshold = 0.0;
+    if (n_prune > 0) {
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + (n_prune - 1), magnitudes.end());
+        threshold = magnitudes[n_prune - 1];
+        n_prune -= std::count_if(magnitudes.begin(), magnitudes.begin() + (n_prune - 1), [&](T m){
+            return m < threshold;
+        });
+    }
+
+    for (std::size_t j = 0; j < weights.rows(); ++j) {
+        auto wj = weights[j];
+        auto mj = mask[j];
+        mj[0] = 1;
+        for (std::size_t i = 1; i < wj.size(); ++i) {
+            T m = std::abs(static_cast<T>(wj[i]));
+            bool prune = (m < threshold) || ((m == threshold) && (n_prune > 0));
+            if ((m == threshold) && prune) {
+                --n_prune;
+            }
+            mj[i] = prune ? 0 : 1;
+        }
+    }
+}
+
+/* Initializes weights uniformly within +-0.2 / fan_in.
+ * @fan_in Number of weights per output (inputs and bias), defaults to the number of columns.
+ */
+template <typename Weights, typename Rng>
+void init_weights(Weights& weights, Rng& rng, std::size_t fan_in) {
+    typedef typename Weights::value_type T;
+
+    T width = 0.2 / static_cast<T>(fan_in);
+    std::uniform_real_distribution<T> dist(-width, width);
+    auto rfunc = std::bind(dist, std::ref(rng));
+
+    for (auto& wj : weights) {
+        std::generate(wj.begin(), wj.end(), rfunc);
+    }
+}
+
+template <typename Weights, typename Rng>
+void init_weights(Weights& weights, Rng& rng) {
+    init_weights(weights, rng, weights.cols());
+}
+}
+
 /* Fully connected layer.
  * @Activation Activation function.
  * @T Floating point type which is used for the entire neural network.
@@ -24,22 +359,18 @@ namespace layer {
 template <typename Activation, typename T = double, typename Rng = std::mt19937>
 class fully_connected {
     public:
-        /* Weight matrix.
+        /* Weight matrix, one row (bias followed by input weights) per output.
          */
-        typedef std::vector<std::vector<T>> weights_t;
+        typedef nntlib::storage::row_matrix<T> weights_t;
         typedef std::vector<T> state_t;
+        typedef std::vector<T> error_t;
 
-        fully_connected(std::size_t n_input, std::size_t n_output, Rng& rng) : weights(n_output) {
-            T width = 0.2 / static_cast<T>(n_input + 1);
-            std::uniform_real_distribution<T> dist(-width, width);
-            auto rfunc = std::bind(dist, std::ref(rng));
-
-            std::generate(weights.begin(), weights.end(), [&]{
-                std::vector<T> wj(n_input + 1);
-                std::generate(wj.begin(), wj.end(), rfunc);
+        /* Block of samples, one row per neuron and one column per sample.
+         */
+        typedef nntlib::storage::batch_matrix<T> batch_state_t;
 
-                return wj;
-            });
+        fully_connected(std::size_t n_input, std::size_t n_output, Rng& rng) : weights(n_output, n_input + 1) {
+            _::init_weights(weights, rng);
         }
 
         fully_connected(const fully_connected& other) = default;
@@ -49,11 +380,11 @@ class fully_connected {
         fully_connected& operator=(fully_connected&& other) = default;
 
         std::size_t size_in() const {
-            return weights[0].size() - 1;
+            return weights.cols() - 1;
         }
 
         std::size_t size_out() const {
-            return weights.size();
+            return weights.rows();
         }
 
         state_t allocate_state() const {
@@ -61,146 +392,1159 @@ class fully_connected {
         }
 
         weights_t allocate_delta_storage() const {
-            weights_t storage;
-            for (const auto& w : weights) {
-                storage.emplace_back(w.size());
-            }
-            return storage;
+            return weights_t(weights.rows(), weights.cols());
         }
 
-        state_t allocate_error_storage() const {
-            return state_t(size_in());
+        error_t allocate_error_storage() const {
+            return error_t(size_in());
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size_out(), batch_size);
+        }
+
+        nntlib::storage::row_matrix<T> allocate_batch_error_storage(std::size_t batch_size) const {
+            return nntlib::storage::row_matrix<T>(size_in(), batch_size);
         }
 
         template <typename InputIt>
         Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
             Activation activation;
 
-            std::transform(weights.begin(), weights.end(), state.begin(), [&](const std::vector<T> wj){
-                return activation.f1(calc_netj(x_first, x_last, wj)); // = oj
+            std::transform(weights.begin(), weights.end(), state.begin(), [&](const auto& wj){
+                return calc_netj(x_first, x_last, wj); // = netj
             });
 
-            std::transform(state.begin(), state.end(), state.begin(), [&](T x){
-                return activation.f2(x);
-            });
+            _::activate(activation, state.data(), state.size());
 
             return activation;
         }
 
-        template <typename InputIt>
-        void backward(InputIt x_first, InputIt x_last, const std::vector<T>& prev_error, state_t& error_mem, weights_t& gradient, Activation activation) const {
-            std::fill(error_mem.begin(), error_mem.end(), 0.0);
+        /* Backward pass.
+         * @x_first Begin of the input.
+         * @x_last End of the input.
+         * @y Output of the forward pass, used to calculate the derivative of the activation.
+         * @prev_error Error of the next layer.
+         * @error_mem Error of this layer.
+         * @gradient Gradient.
+         * @activation Cache returned by <forward>.
+         */
+        template <typename InputIt, typename PrevError>
+        void backward(InputIt x_first, InputIt x_last, const state_t& y, const PrevError& prev_error, error_t& error_mem, weights_t& gradient, Activation activation) const {
+            _::fc_backward(weights, x_first, x_last, y, prev_error, error_mem, gradient, activation);
+        }
 
-            for (std::size_t j = 0; j < size_out(); ++j) {
-                T de_doj = prev_error[j];
-                T doj_dnetj = activation.df(calc_netj(x_first, x_last, weights[j]));
-                T dj = de_doj * doj_dnetj;
-
-                std::vector<T>& gradientj = gradient[j];
-                gradientj[0] = dj;
-                std::transform(x_first, x_last, std::next(gradientj.begin()), [&](T xi){
-                    return dj * xi;
-                });
+        /* Forward pass for a block of samples (one matrix-matrix product).
+         * @x Input block, one column per sample.
+         * @n Number of samples, i.e. number of used columns.
+         * @state Output block.
+         * @_training Ignored.
+         */
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool _training) const {
+            _::fc_forward_batch<Activation>(weights, x, n, state);
+            return nntlib::utils::undef{};
+        }
 
-                for (std::size_t i = 0; i < error_mem.size(); ++i) {
-                    error_mem[i] += dj * weights[j][i + 1];
-                }
-            }
+        /* Backward pass for a block of samples.
+         * @x Input block, one column per sample.
+         * @n Number of samples, i.e. number of used columns.
+         * @state Output block of the forward pass.
+         * @prev_error Error block of the next layer, gets overwritten with the local deltas.
+         * @error_mem Error block of this layer.
+         * @gradient Sum of the gradients of all samples.
+         */
+        void backward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, const batch_state_t& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& error_mem, weights_t& gradient, nntlib::utils::undef) const {
+            _::fc_backward_batch<Activation>(weights, x, n, state, prev_error, error_mem, gradient);
         }
 
         /* Update layer using a delta.
          * @delta Delta matrix, should be premultiplied with learning rate.
          */
         void update(const weights_t& delta) {
-            nntlib::utils::multi_foreach([](auto& wj1, const auto& wj2){
-                nntlib::utils::multi_foreach([](auto& wji1, const auto& wji2){
-                    wji1 += wji2;
-                }, wj1.begin(), wj1.end(), wj2.begin(), wj2.end());
-            }, weights.begin(), weights.end(), delta.begin(), delta.end());
+            _::add_buffer(weights, delta);
         }
 
         const weights_t& get_weights() const {
             return weights;
         }
 
+        weights_t& get_weights() {
+            return weights;
+        }
+
     private:
         weights_t weights;
 
         template <typename InputIt>
-        static T calc_netj(InputIt x_first, InputIt x_last, const std::vector<T>& wj) {
-            T netj = wj[0];
-            std::size_t k = 1;
-            for (; (x_first != x_last) && (k < wj.size()); ++x_first) {
-                netj += (*x_first) * wj[k];
-                ++k;
+        static T calc_netj(InputIt x_first, InputIt x_last, typename weights_t::const_row_t wj) {
+            return _::netj_mixed<T>(wj.data(), wj.size(), x_first, x_last, typename std::iterator_traits<InputIt>::iterator_category{});
+        }
+};
+
+/* Fully connected layer with sizes known at compile time.
+ * @Activation Activation function.
+ * @In Number of inputs.
+ * @Out Number of outputs.
+ * @T Floating point type which is used for the entire neural network.
+ * @Rng Random number generator used to initalize the weights.
+ *
+ * Weights, state and error storage are std::array based and do not use the
+ * heap, and all loops of the forward pass have a fixed trip count. Intended
+ * for small nets. Batch blocks still use the heap.
+ */
+template <typename Activation, std::size_t In, std::size_t Out, typename T = double, typename Rng = std::mt19937>
+class fully_connected_fixed {
+    public:
+        /* Weight matrix, one row (bias followed by input weights) per output.
+         */
+        typedef nntlib::storage::fixed_row_matrix<T, Out, In + 1> weights_t;
+        typedef std::array<T, Out> state_t;
+        typedef std::array<T, In> error_t;
+
+        /* Block of samples, one row per neuron and one column per sample.
+         */
+        typedef nntlib::storage::batch_matrix<T> batch_state_t;
+
+        explicit fully_connected_fixed(Rng& rng) {
+            _::init_weights(weights, rng);
+        }
+
+        fully_connected_fixed(const fully_connected_fixed& other) = default;
+        fully_connected_fixed(fully_connected_fixed&& other) = default;
+
+        fully_connected_fixed& operator=(const fully_connected_fixed& other) = default;
+        fully_connected_fixed& operator=(fully_connected_fixed&& other) = default;
+
+        static constexpr std::size_t size_in() {
+            return In;
+        }
+
+        static constexpr std::size_t size_out() {
+            return Out;
+        }
+
+        state_t allocate_state() const {
+            return state_t{};
+        }
+
+        weights_t allocate_delta_storage() const {
+            return weights_t{};
+        }
+
+        error_t allocate_error_storage() const {
+            return error_t{};
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(Out, batch_size);
+        }
+
+        nntlib::storage::row_matrix<T> allocate_batch_error_storage(std::size_t batch_size) const {
+            return nntlib::storage::row_matrix<T>(In, batch_size);
+        }
+
+        /* Forward pass. Missing inputs are treated as zero, surplus inputs are ignored.
+         */
+        template <typename InputIt>
+        Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
+            Activation activation;
+
+            std::array<T, In> x{};
+            for (std::size_t i = 0; (i < In) && (x_first != x_last); ++i, ++x_first) {
+                x[i] = *x_first;
+            }
+
+            for (std::size_t j = 0; j < Out; ++j) {
+                const T* wj = weights[j].data();
+                T netj = wj[0];
+                for (std::size_t i = 0; i < In; ++i) {
+                    netj += x[i] * wj[i + 1];
+                }
+                state[j] = netj;
             }
-            return netj;
+
+            _::activate(activation, state.data(), Out);
+
+            return activation;
+        }
+
+        /* Backward pass, see <fully_connected>.
+         */
+        template <typename InputIt, typename PrevError>
+        void backward(InputIt x_first, InputIt x_last, const state_t& y, const PrevError& prev_error, error_t& error_mem, weights_t& gradient, Activation activation) const {
+            _::fc_backward(weights, x_first, x_last, y, prev_error, error_mem, gradient, activation);
+        }
+
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool _training) const {
+            _::fc_forward_batch<Activation>(weights, x, n, state);
+            return nntlib::utils::undef{};
+        }
+
+        void backward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, const batch_state_t& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& error_mem, weights_t& gradient, nntlib::utils::undef) const {
+            _::fc_backward_batch<Activation>(weights, x, n, state, prev_error, error_mem, gradient);
         }
+
+        void update(const weights_t& delta) {
+            _::add_buffer(weights, delta);
+        }
+
+        const weights_t& get_weights() const {
+            return weights;
+        }
+
+        weights_t& get_weights() {
+            return weights;
+        }
+
+    private:
+        weights_t weights;
 };
 
-template <typename T = double, typename Rng = std::mt19937>
-class dropout {
+/* Fully connected layer for mixed-precision training.
+ * @Activation Activation function.
+ * @Storage Value type of the compact copy, e.g. float or <nntlib::storage::bfloat16>.
+ * @T Compute type, used for states, accumulation, gradients and the master copy of the weights.
+ * @Rng Random number generator used to initalize the weights.
+ *
+ * All forward and backward passes (single samples and blocks) read the compact
+ * copy of the weights and accumulate in T, which reduces the memory bandwidth
+ * of large layers. The master copy is only used by <update>, so small deltas
+ * do not get lost in the rounding of the compact copy, which gets refreshed
+ * within the same pass.
+ */
+template <typename Activation, typename Storage, typename T = double, typename Rng = std::mt19937>
+class fully_connected_mixed {
     public:
-        /* Weight matrix. Will be empty.
+        /* Master weights, one row (bias followed by input weights) per output.
          */
-        typedef std::vector<std::vector<T>> weights_t;
+        typedef nntlib::storage::row_matrix<T> weights_t;
         typedef std::vector<T> state_t;
+        typedef std::vector<T> error_t;
 
-        dropout(std::size_t iosize, double probability, const Rng& rng_lvalue, T dropout_value = 0.0) : size(iosize), rng(rng_lvalue), prob(probability), dist(0.0, 1.0), value(dropout_value) {}
-        dropout(std::size_t iosize, double probability, Rng&& rng_rvalue, T dropout_value = 0.0) : size(iosize), rng(std::move(rng_rvalue)), prob(probability), dist(0.0, 1.0), value(dropout_value) {}
+        /* Block of samples, one row per neuron and one column per sample.
+         */
+        typedef nntlib::storage::batch_matrix<T> batch_state_t;
 
-        dropout(const dropout& other) = default;
-        dropout(dropout&& other) = default;
+        fully_connected_mixed(std::size_t n_input, std::size_t n_output, Rng& rng) : weights(n_output, n_input + 1), compact(n_output, n_input + 1) {
+            _::init_weights(weights, rng);
+            refresh();
+        }
 
-        dropout& operator=(const dropout& other) = default;
-        dropout& operator=(dropout&& other) = default;
+        fully_connected_mixed(const fully_connected_mixed& other) = default;
+        fully_connected_mixed(fully_connected_mixed&& other) = default;
+
+        fully_connected_mixed& operator=(const fully_connected_mixed& other) = default;
+        fully_connected_mixed& operator=(fully_connected_mixed&& other) = default;
 
         std::size_t size_in() const {
-            return size;
+            return weights.cols() - 1;
         }
 
         std::size_t size_out() const {
-            return size;
+            return weights.rows();
         }
 
         state_t allocate_state() const {
-            return state_t(size);
+            return state_t(size_out());
         }
 
         weights_t allocate_delta_storage() const {
-            return weights_t{};
+            return weights_t(weights.rows(), weights.cols());
         }
 
-        state_t allocate_error_storage() const {
-            return state_t(size);
+        error_t allocate_error_storage() const {
+            return error_t(size_in());
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size_out(), batch_size);
+        }
+
+        nntlib::storage::row_matrix<T> allocate_batch_error_storage(std::size_t batch_size) const {
+            return nntlib::storage::row_matrix<T>(size_in(), batch_size);
         }
 
         template <typename InputIt>
-        nntlib::utils::undef forward(InputIt x_first, InputIt x_last, state_t& state, bool training) const {
-            std::transform(x_first, x_last, state.begin(), [&](T xi){
-                return (!training || (dist(rng) >= prob)) ? xi : value;
+        Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
+            Activation activation;
+
+            std::transform(compact.begin(), compact.end(), state.begin(), [&](const auto& wj){
+                return _::netj_mixed<T>(wj.data(), wj.size(), x_first, x_last, typename std::iterator_traits<InputIt>::iterator_category{});
             });
 
+            _::activate(activation, state.data(), state.size());
+
+            return activation;
+        }
+
+        /* Backward pass, see <fully_connected>.
+         */
+        template <typename InputIt, typename PrevError>
+        void backward(InputIt x_first, InputIt x_last, const state_t& y, const PrevError& prev_error, error_t& error_mem, weights_t& gradient, Activation activation) const {
+            _::fc_backward(compact, x_first, x_last, y, prev_error, error_mem, gradient, activation);
+        }
+
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool _training) const {
+            _::fc_forward_batch_mixed<Activation>(compact, x, n, state);
             return nntlib::utils::undef{};
         }
 
-        template <typename InputIt>
-        void backward(InputIt _x_first, InputIt _x_last, const std::vector<T>& prev_error, state_t& error_mem, weights_t& _gradient, nntlib::utils::undef) const {
-            std::copy(prev_error.begin(), prev_error.end(), error_mem.begin());
+        void backward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, const batch_state_t& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& error_mem, weights_t& gradient, nntlib::utils::undef) const {
+            _::fc_backward_batch_mixed<Activation>(compact, x, n, state, prev_error, error_mem, gradient);
         }
 
-        void update(const weights_t& _delta) {/* noop */}
+        /* Updates the master copy and refreshes the compact copy within the same pass.
+         */
+        void update(const weights_t& delta) {
+            for (std::size_t j = 0; j < weights.rows(); ++j) {
+                T* w = weights[j].data();
+                const T* d = delta[j].data();
+                Storage* c = compact[j].data();
+                for (std::size_t i = 0; i < weights.cols(); ++i) {
+                    w[i] += d[i];
+                    c[i] = static_cast<Storage>(w[i]);
+                }
+            }
+        }
+
+        const weights_t& get_weights() const {
+            return weights;
+        }
+
+        /* Writable master copy, call <update> (e.g. with zeros) or <refresh> afterwards.
+         */
+        weights_t& get_weights() {
+            return weights;
+        }
 
-        weights_t get_weights() const {
-            return {};
+        /* Copies the master weights into the compact copy.
+         */
+        void refresh() {
+            for (std::size_t j = 0; j < weights.rows(); ++j) {
+                std::transform(weights[j].begin(), weights[j].end(), compact[j].begin(), [](T wji){
+                    return static_cast<Storage>(wji);
+                });
+            }
         }
 
     private:
-        std::size_t size;
-        mutable Rng rng;
-        double prob;
-        mutable std::uniform_real_distribution<double> dist;
-        T value;
+        weights_t weights;
+        nntlib::storage::row_matrix<Storage> compact;
+};
+
+/* Inference-only fully connected layer with 8 bit integer weights.
+ * @Activation Activation function.
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * Built from a trained layer with row matrix weights (e.g. <fully_connected>).
+ * Every weight row gets quantized symmetrically to [-127, 127] using its own
+ * scale. Inputs are quantized to [-63, 63] using a single scale that is
+ * calibrated on sample inputs, values outside of the calibrated range get
+ * clipped. Dot products are accumulated in 32 bit integers. There is no
+ * backward pass and no update, so train the float version and swap this layer
+ * in afterwards.
+ */
+template <typename Activation, typename T = double>
+class quantized_fully_connected {
+    public:
+        typedef nntlib::utils::undef weights_t;
+        typedef std::vector<std::uint8_t, nntlib::storage::aligned_allocator<std::uint8_t>> input_t;
+        typedef std::vector<T> error_t;
+
+        /* Outputs, also carries the buffer for the quantized input.
+         */
+        class state_t : public std::vector<T> {
+            public:
+                state_t(std::size_t n_output, std::size_t n_padded) : std::vector<T>(n_output), input(n_padded, 0) {}
+
+                input_t input;
+        };
+
+        /* Block of samples, one row per neuron and one column per sample. Also carries the buffer for the quantized input.
+         */
+        class batch_state_t : public nntlib::storage::batch_matrix<T> {
+            public:
+                batch_state_t(std::size_t rows, std::size_t cols, std::size_t n_padded) : nntlib::storage::batch_matrix<T>(rows, cols), input(n_padded, 0) {}
+
+                input_t input;
+        };
+
+        /* Quantizes a trained layer and calibrates the input range.
+         * @trained Trained layer.
+         * @x_first Begin of sample inputs of this layer (e.g. outputs of the previous layer), must yield containers.
+         * @x_last End of sample inputs.
+         */
+        template <typename Layer, typename InputIt>
+        quantized_fully_connected(const Layer& trained, InputIt x_first, InputIt x_last) : quantized_fully_connected(trained, calibrate(x_first, x_last)) {}
+
+        /* Quantizes a trained layer.
+         * @trained Trained layer.
+         * @input_range Largest absolute input value that can be represented.
+         */
+        template <typename Layer>
+        quantized_fully_connected(const Layer& trained, T input_range) :
+                weights(trained.size_out(), trained.size_in()),
+                row_scale(trained.size_out()),
+                row_offset(trained.size_out()) {
+            const auto& w = trained.get_weights();
+            T in_scale = (input_range > 0.0) ? (input_range / input_max) : 1.0;
+            in_factor = 1.0 / in_scale;
+
+            for (std::size_t j = 0; j < weights.rows(); ++j) {
+                auto wj = w[j];
+                T absmax = 0.0;
+                for (std::size_t i = 1; i < wj.size(); ++i) {
+                    absmax = std::max<T>(absmax, std::abs(static_cast<T>(wj[i])));
+                }
+                T w_scale = (absmax > 0.0) ? (absmax / 127.0) : 1.0;
+
+                std::int8_t* qj = weights[j].data();
+                std::int32_t sum = 0;
+                for (std::size_t i = 1; i < wj.size(); ++i) {
+                    qj[i - 1] = static_cast<std::int8_t>(std::lround(static_cast<T>(wj[i]) / w_scale));
+                    sum += qj[i - 1];
+                }
+
+                // quantized inputs are stored with an offset, which gets removed using the row sum
+                row_scale[j] = w_scale * in_scale;
+                row_offset[j] = static_cast<T>(wj[0]) - row_scale[j] * static_cast<T>(input_offset * sum);
+            }
+        }
+
+        quantized_fully_connected(const quantized_fully_connected& other) = default;
+        quantized_fully_connected(quantized_fully_connected&& other) = default;
+
+        quantized_fully_connected& operator=(const quantized_fully_connected& other) = default;
+        quantized_fully_connected& operator=(quantized_fully_connected&& other) = default;
+
+        std::size_t size_in() const {
+            return weights.cols();
+        }
+
+        std::size_t size_out() const {
+            return weights.rows();
+        }
+
+        /* Operations of a forward pass over n samples (one integer multiply-add per weight, scale and offset per output), see <nntlib::instrumentation>.
+         */
+        std::size_t flops(std::size_t n_samples) const {
+            return 2 * size_out() * (size_in() + 1) * n_samples;
+        }
+
+        state_t allocate_state() const {
+            return state_t(size_out(), weights.stride());
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size_out(), batch_size, weights.stride());
+        }
+
+        template <typename InputIt>
+        Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
+            Activation activation;
+
+            std::uint8_t* q = state.input.data();
+            std::size_t i = 0;
+            for (; (x_first != x_last) && (i < size_in()); ++x_first) {
+                q[i++] = quantize(*x_first);
+            }
+            std::fill(q + i, q + size_in(), static_cast<std::uint8_t>(input_offset));
+
+            for (std::size_t j = 0; j < size_out(); ++j) {
+                state[j] = netj(q, j);
+            }
+
+            _::activate(activation, state.data(), state.size());
+
+            return activation;
+        }
+
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool _training) const {
+            std::uint8_t* q = state.input.data();
+            for (std::size_t b = 0; b < n; ++b) {
+                for (std::size_t i = 0; i < size_in(); ++i) {
+                    q[i] = quantize(x(i, b));
+                }
+                for (std::size_t j = 0; j < size_out(); ++j) {
+                    state(j, b) = netj(q, j);
+                }
+            }
+
+            _::activate_block<Activation>(state, n, typename std::is_empty<Activation>::type{});
+
+            return nntlib::utils::undef{};
+        }
+
+    private:
+        static constexpr std::int32_t input_max = 63;
+        static constexpr std::int32_t input_offset = 64;
+
+        nntlib::storage::row_matrix<std::int8_t> weights;
+        std::vector<T> row_scale;
+        std::vector<T> row_offset;
+        T in_factor;
+
+        std::uint8_t quantize(T xi) const {
+            T v = xi * in_factor;
+            v = std::min<T>(std::max<T>(v, -input_max), input_max);
+            // round half up, the value is positive after adding the offset
+            return static_cast<std::uint8_t>(v + (input_offset + 0.5));
+        }
+
+        T netj(const std::uint8_t* q, std::size_t j) const {
+            // padding of the weights is zero, so the dot product can run over the entire row
+            return row_offset[j] + row_scale[j] * static_cast<T>(_::dot_u8s8(q, weights[j].data(), weights.stride()));
+        }
+
+        template <typename InputIt>
+        static T calibrate(InputIt x_first, InputIt x_last) {
+            T range = 0.0;
+            for (; x_first != x_last; ++x_first) {
+                for (const auto& xi : *x_first) {
+                    range = std::max<T>(range, std::abs(static_cast<T>(xi)));
+                }
+            }
+            return range;
+        }
+};
+
+/* Trainable layer with a fixed pruning mask, used to fine-tune a pruned layer.
+ * @Layer Layer with row matrix weights (e.g. <fully_connected>).
+ *
+ * The input weights with the smallest magnitudes are set to zero and stay zero
+ * after every <update> and <refresh> (trainers like <nntlib::training::adam>
+ * write the weights directly and call <refresh> afterwards). Everything else
+ * behaves like the wrapped layer. Convert the result into a
+ * <sparse_fully_connected> for inference.
+ */
+template <typename Layer>
+class pruned : public Layer {
+    public:
+        typedef typename Layer::weights_t weights_t;
+
+        /* Prunes a trained layer.
+         * @trained Trained layer.
+         * @sparsity Fraction of the input weights to prune, within [0, 1].
+         */
+        pruned(const Layer& trained, double sparsity) : Layer(trained), mask(trained.get_weights()) {
+            _::prune_mask(Layer::get_weights(), sparsity, mask);
+            refresh();
+        }
+
+        pruned(const pruned& other) = default;
+        pruned(pruned&& other) = default;
+
+        pruned& operator=(const pruned& other) = default;
+        pruned& operator=(pruned&& other) = default;
+
+        /* Update layer using a delta, pruned weights stay zero.
+         * @delta Delta matrix, should be premultiplied with learning rate.
+         */
+        void update(const weights_t& delta) {
+            Layer::update(delta);
+            refresh();
+        }
+
+        /* Sets the pruned weights back to zero and refreshes the wrapped layer.
+         */
+        void refresh() {
+            auto& weights = Layer::get_weights();
+            auto* w = weights.data();
+            const auto* m = mask.data();
+            for (std::size_t i = 0; i < weights.buffer_size(); ++i) {
+                w[i] *= m[i];
+            }
+            nntlib::utils::refresh_layer(static_cast<Layer&>(*this));
+        }
+
+        /* Rebuilds the mask from the current weights (zero input weights are pruned) and refreshes the wrapped layer.
+         *
+         * Called by <nntlib::model::load>, so loading a stored pruned net keeps
+         * its pruning instead of applying the mask of the randomly initialized
+         * layer.
+         */
+        void reload() {
+            const auto& weights = Layer::get_weights();
+            for (std::size_t j = 0; j < weights.rows(); ++j) {
+                auto wj = weights[j];
+                auto mj = mask[j];
+                mj[0] = 1;
+                for (std::size_t i = 1; i < wj.size(); ++i) {
+                    mj[i] = (wj[i] != 0) ? 1 : 0;
+                }
+            }
+            refresh();
+        }
+
+        /* Mask with the same layout as the weights, 1 for kept and 0 for pruned weights.
+         */
+        const weights_t& get_mask() const {
+            return mask;
+        }
+
+    private:
+        weights_t mask;
+};
+
+/* Inference-only fully connected layer with sparse weights (compressed sparse rows).
+ * @Activation Activation function.
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * Built from a trained layer with row matrix weights (e.g. <fully_connected> or
+ * <pruned>). Only the non-zero input weights are stored, together with their
+ * 32 bit column index, so forward passes scale with the number of remaining
+ * weights. The batch forward pass adds one input row (i.e. the values of all
+ * samples) per weight, which keeps the inner loop contiguous. There is no
+ * backward pass and no update, so train (and fine-tune) a <pruned> version and
+ * swap this layer in afterwards. It has no weight matrix, so it cannot be
+ * stored with <nntlib::model::save>: store the <pruned> net and convert it
+ * after loading.
+ */
+template <typename Activation, typename T = double>
+class sparse_fully_connected {
+    public:
+        typedef nntlib::utils::undef weights_t;
+        typedef std::vector<T> error_t;
+
+        /* Outputs, also carries a copy of the input for random access.
+         */
+        class state_t : public std::vector<T> {
+            public:
+                state_t(std::size_t n_output, std::size_t n_input) : std::vector<T>(n_output), input(n_input) {}
+
+                std::vector<T> input;
+        };
+
+        /* Block of samples, one row per neuron and one column per sample.
+         */
+        typedef nntlib::storage::batch_matrix<T> batch_state_t;
+
+        /* Converts a trained layer, dropping all input weights that are zero.
+         * @trained Trained layer.
+         * @sparsity Fraction of the input weights with the smallest magnitudes to prune before the conversion, within [0, 1].
+         */
+        template <typename Layer>
+        explicit sparse_fully_connected(const Layer& trained, double sparsity = 0.0) :
+                n_input(trained.size_in()),
+                bias(trained.size_out()),
+                row_offsets(trained.size_out() + 1, 0) {
+            const auto& w = trained.get_weights();
+            typename std::decay<decltype(w)>::type mask(w);
+            _::prune_mask(w, sparsity, mask);
+
+            for (std::size_t j = 0; j < bias.size(); ++j) {
+                auto wj = w[j];
+                auto mj = mask[j];
+                bias[j] = static_cast<T>(wj[0]);
+                for (std::size_t i = 1; i < wj.size(); ++i) {
+                    if ((mj[i] != 0) && (wj[i] != 0)) {
+                        indices.push_back(static_cast<std::uint32_t>(i - 1));
+                        values.push_back(static_cast<T>(wj[i]));
+                    }
+                }
+                row_offsets[j + 1] = indices.size();
+            }
+        }
+
+        sparse_fully_connected(const sparse_fully_connected& other) = default;
+        sparse_fully_connected(sparse_fully_connected&& other) = default;
+
+        sparse_fully_connected& operator=(const sparse_fully_connected& other) = default;
+        sparse_fully_connected& operator=(sparse_fully_connected&& other) = default;
+
+        std::size_t size_in() const {
+            return n_input;
+        }
+
+        std::size_t size_out() const {
+            return bias.size();
+        }
+
+        /* Number of stored (non-zero) input weights.
+         */
+        std::size_t nnz() const {
+            return values.size();
+        }
+
+        /* Operations of a forward pass over n samples (one multiply-add per stored weight and bias), see <nntlib::instrumentation>.
+         */
+        std::size_t flops(std::size_t n_samples) const {
+            return 2 * (nnz() + size_out()) * n_samples;
+        }
+
+        state_t allocate_state() const {
+            return state_t(size_out(), size_in());
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size_out(), batch_size);
+        }
+
+        template <typename InputIt>
+        Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
+            Activation activation;
+
+            T* x = state.input.data();
+            std::size_t i = 0;
+            for (; (x_first != x_last) && (i < size_in()); ++x_first) {
+                x[i++] = *x_first;
+            }
+            std::fill(x + i, x + size_in(), T(0));
+
+            for (std::size_t j = 0; j < size_out(); ++j) {
+                T netj = bias[j];
+                for (std::size_t k = row_offsets[j]; k < row_offsets[j + 1]; ++k) {
+                    netj += values[k] * x[indices[k]];
+                }
+                state[j] = netj;
+            }
+
+            _::activate(activation, state.data(), state.size());
+
+            return activation;
+        }
+
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool _training) const {
+            for (std::size_t j = 0; j < size_out(); ++j) {
+                T* yj = state[j].data();
+                std::fill_n(yj, n, bias[j]);
+                for (std::size_t k = row_offsets[j]; k < row_offsets[j + 1]; ++k) {
+                    const T* xi = x.data() + indices[k] * x.stride();
+                    const T v = values[k];
+                    for (std::size_t b = 0; b < n; ++b) {
+                        yj[b] += v * xi[b];
+                    }
+                }
+            }
+
+            _::activate_block<Activation>(state, n, typename std::is_empty<Activation>::type{});
+
+            return nntlib::utils::undef{};
+        }
+
+    private:
+        std::size_t n_input;
+        std::vector<T> bias;
+        std::vector<std::size_t> row_offsets;
+        std::vector<std::uint32_t> indices;
+        std::vector<T> values;
+};
+
+/* Fully connected layer for sparse inputs, e.g. one-hot or hashed features.
+ * @Activation Activation function.
+ * @T Floating point type which is used for the entire neural network.
+ * @Rng Random number generator used to initalize the weights.
+ *
+ * Inputs are sequences of (index, value) pairs (e.g. std::pair<std::size_t, T>)
+ * instead of dense vectors, batches are passed as <nntlib::storage::sparse_block>.
+ * The weights are stored transposed (one row per input), so the forward pass
+ * gathers one contiguous row per active input and the gradient only touches
+ * these rows. Costs therefore scale with the number of active inputs, not with
+ * the input dimension.
+ *
+ * The layer does not calculate the error of its input, so it must be the
+ * first layer of a net.
+ */
+template <typename Activation, typename T = double, typename Rng = std::mt19937>
+class sparse_input {
+    public:
+        /* Weight matrix, one row per input (row 0 holds the bias), each row has one column per output.
+         */
+        typedef nntlib::storage::sparse_rows<T> weights_t;
+        typedef std::vector<T> state_t;
+        typedef std::vector<T> error_t;
+
+        /* Block of samples, one row per neuron and one column per sample. Also carries a transposed copy (one row per sample).
+         */
+        class batch_state_t : public nntlib::storage::batch_matrix<T> {
+            public:
+                batch_state_t(std::size_t rows, std::size_t cols) : nntlib::storage::batch_matrix<T>(rows, cols), samples(cols, rows) {}
+
+                /* Written by <backward_batch> as well, which only gets a const state.
+                 */
+                mutable nntlib::storage::row_matrix<T> samples;
+        };
+
+        /* Block of input samples.
+         */
+        typedef nntlib::storage::sparse_block<T> batch_input_t;
+
+        sparse_input(std::size_t n_input, std::size_t n_output, Rng& rng) : weights(n_input + 1, n_output) {
+            // rows are inputs, so the number of columns is not the fan-in
+            _::init_weights(weights, rng, n_input + 1);
+        }
+
+        sparse_input(const sparse_input& other) = default;
+        sparse_input(sparse_input&& other) = default;
+
+        sparse_input& operator=(const sparse_input& other) = default;
+        sparse_input& operator=(sparse_input&& other) = default;
+
+        std::size_t size_in() const {
+            return weights.rows() - 1;
+        }
+
+        std::size_t size_out() const {
+            return weights.cols();
+        }
+
+        /* Operations of a forward pass over n samples without the active inputs (i.e. only the bias), see <nntlib::instrumentation>. The passes record the operations of the active inputs themselves.
+         */
+        std::size_t flops(std::size_t n_samples) const {
+            return 2 * size_out() * n_samples;
+        }
+
+        state_t allocate_state() const {
+            return state_t(size_out());
+        }
+
+        weights_t allocate_delta_storage() const {
+            return weights_t(weights.rows(), weights.cols());
+        }
+
+        error_t allocate_error_storage() const {
+            return error_t();
+        }
+
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size_out(), batch_size);
+        }
+
+        nntlib::storage::row_matrix<T> allocate_batch_error_storage(std::size_t batch_size) const {
+            return nntlib::storage::row_matrix<T>(0, batch_size);
+        }
+
+        /* Forward pass.
+         * @x_first Begin of the input, must yield (index, value) pairs.
+         * @x_last End of the input.
+         * @state Output.
+         * @_training Ignored.
+         */
+        template <typename InputIt>
+        Activation forward(InputIt x_first, InputIt x_last, state_t& state, bool _training) const {
+            Activation activation;
+
+            const std::size_t n_output = size_out();
+            const T* bias = weights[0].data();
+            std::copy(bias, bias + n_output, state.begin());
+            std::size_t n_active = 0;
+            for (; x_first != x_last; ++x_first) {
+                std::size_t i = static_cast<std::size_t>(x_first->first);
+                if (i < size_in()) {
+                    add_scaled(state.data(), weights[i + 1].data(), static_cast<T>(x_first->second), n_output);
+                    ++n_active;
+                }
+            }
+            NNTLIB_INSTRUMENT_FLOPS(2 * n_active * n_output);
+
+            _::activate(activation, state.data(), state.size());
+
+            return activation;
+        }
+
+        /* Backward pass, only touches the gradient rows of the bias and the active inputs.
+         * @x_first Begin of the input, must yield (index, value) pairs.
+         * @x_last End of the input.
+         * @y Output of the forward pass, used to calculate the derivative of the activation.
+         * @prev_error Error of the next layer.
+         * @_error_mem Ignored, the error of the input is not calculated.
+         * @gradient Gradient.
+         * @activation Cache returned by <forward>.
+         */
+        template <typename InputIt, typename PrevError>
+        void backward(InputIt x_first, InputIt x_last, const state_t& y, const PrevError& prev_error, error_t& _error_mem, weights_t& gradient, Activation activation) const {
+            const std::size_t n_output = size_out();
+            gradient.clear();
+
+            T* d = gradient.touch(0);
+            for (std::size_t j = 0; j < n_output; ++j) {
+                d[j] = prev_error[j] * activation.df_y(y[j]);
+            }
+
+            std::size_t n_active = 0;
+            for (; x_first != x_last; ++x_first) {
+                std::size_t i = static_cast<std::size_t>(x_first->first);
+                if (i < size_in()) {
+                    add_scaled(gradient.touch(i + 1), d, static_cast<T>(x_first->second), n_output);
+                    ++n_active;
+                }
+            }
+            NNTLIB_INSTRUMENT_FLOPS(2 * n_active * n_output);
+        }
+
+        /* Forward pass for a block of samples.
+         * @x Input block, one column per sample.
+         * @n Number of samples, i.e. number of used columns.
+         * @state Output block.
+         * @_training Ignored.
+         */
+        nntlib::utils::undef forward_batch(const batch_input_t& x, std::size_t n, batch_state_t& state, bool _training) const {
+            // accumulate one contiguous row per sample, then transpose the entire block
+            const std::size_t n_output = size_out();
+            const T* bias = weights[0].data();
+            std::size_t n_active = 0;
+            for (std::size_t b = 0; b < n; ++b) {
+                T* y = state.samples[b].data();
+                std::copy(bias, bias + n_output, y);
+                const std::uint32_t* indices = x.col_indices(b);
+                const T* values = x.col_values(b);
+                for (std::size_t k = 0; k < x.nnz(b); ++k) {
+                    add_scaled(y, weights[indices[k] + 1].data(), values[k], n_output);
+                }
+                n_active += x.nnz(b);
+            }
+            NNTLIB_INSTRUMENT_FLOPS(2 * n_active * n_output);
+            nntlib::storage::as_eigen(state, n).noalias() = nntlib::storage::as_eigen(state.samples).topRows(n).transpose();
+
+            _::activate_block<Activation>(state, n, typename std::is_empty<Activation>::type{});
+            return nntlib::utils::undef{};
+        }
+
+        /* Backward pass for a block of samples.
+         * @x Input block, one column per sample.
+         * @n Number of samples, i.e. number of used columns.
+         * @state Output block of the forward pass.
+         * @prev_error Error block of the next layer, gets overwritten with the local deltas.
+         * @_error_mem Ignored, the error of the input is not calculated.
+         * @gradient Sum of the gradients of all samples, only the rows of the bias and the active inputs get touched.
+         */
+        void backward_batch(const batch_input_t& x, std::size_t n, const batch_state_t& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& _error_mem, weights_t& gradient, nntlib::utils::undef) const {
+            const std::size_t n_output = size_out();
+            for (std::size_t j = 0; j < n_output; ++j) {
+                const T* yj = state[j].data();
+                T* dj = prev_error[j].data();
+                for (std::size_t b = 0; b < n; ++b) {
+                    dj[b] *= Activation::df_y(yj[b]);
+                }
+            }
+
+            // transpose the deltas, so every sample adds contiguous rows
+            nntlib::storage::as_eigen(state.samples).topRows(n).noalias() = nntlib::storage::as_eigen(prev_error, n).transpose();
+
+            gradient.clear();
+            T* g_bias = gradient.touch(0);
+            std::size_t n_active = 0;
+            for (std::size_t b = 0; b < n; ++b) {
+                const T* d = state.samples[b].data();
+                add_scaled(g_bias, d, T(1), n_output);
+
+                const std::uint32_t* indices = x.col_indices(b);
+                const T* values = x.col_values(b);
+                for (std::size_t k = 0; k < x.nnz(b); ++k) {
+                    add_scaled(gradient.touch(indices[k] + 1), d, values[k], n_output);
+                }
+                n_active += x.nnz(b);
+            }
+            NNTLIB_INSTRUMENT_FLOPS(2 * n_active * n_output);
+        }
+
+        /* Update layer using a delta.
+         * @delta Delta matrix, should be premultiplied with learning rate. Only the touched rows are applied.
+         */
+        void update(const weights_t& delta) {
+            for (std::size_t j : delta.touched_rows()) {
+                add_scaled(weights[j].data(), delta[j].data(), T(1), size_out());
+            }
+        }
+
+        const weights_t& get_weights() const {
+            return weights;
+        }
+
+        weights_t& get_weights() {
+            return weights;
+        }
+
+    private:
+        weights_t weights;
+
+        static void add_scaled(T* y, const T* w, T v, std::size_t n) {
+            for (std::size_t j = 0; j < n; ++j) {
+                y[j] += v * w[j];
+            }
+        }
+};
+
+/* Dropout layer.
+ * @T Value type.
+ * @Rng Generator that is used to seed the internal <nntlib::utils::xoshiro256> generator.
+ *
+ * During training, every element is replaced by the dropout value with the
+ * given probability. The keep-mask is generated in bulk (16 random bits per
+ * element, so probabilities are resolved in steps of 1/65536), stored within
+ * the state and applied by a multiplication. The backward pass uses the same
+ * mask, so dropped elements do not receive any error.
+ */
+template <typename T = double, typename Rng = std::mt19937>
+class dropout {
+    public:
+        typedef nntlib::utils::xoshiro256 generator_t;
+
+        /* Weight matrix. Will be empty.
+         */
+        typedef nntlib::storage::row_matrix<T> weights_t;
+        typedef std::vector<T> error_t;
+
+        /* Output of the layer, also carries the mask of the last training pass (1 = keep, 0 = drop).
+         */
+        class state_t : public std::vector<T> {
+            public:
+                explicit state_t(std::size_t size) : std::vector<T>(size), mask(size, T(1)) {}
+
+                std::vector<T> mask;
+        };
+
+        /* Block of samples that carries its own random number generator, so
+         * multiple blocks can be processed concurrently. Also carries the mask
+         * of the last training pass.
+         */
+        class batch_state_t : public nntlib::storage::row_matrix<T> {
+            public:
+                batch_state_t(std::size_t rows, std::size_t cols, std::uint64_t seed) : nntlib::storage::row_matrix<T>(rows, cols), rng(seed), mask(rows, cols) {}
+
+                generator_t rng;
+                nntlib::storage::row_matrix<T> mask;
+        };
+
+        dropout(std::size_t iosize, double probability, const Rng& rng_lvalue, T dropout_value = 0.0) : weights(), size(iosize), rng(seed(Rng(rng_lvalue))), threshold(to_threshold(probability)), value(dropout_value) {}
+        dropout(std::size_t iosize, double probability, Rng&& rng_rvalue, T dropout_value = 0.0) : weights(), size(iosize), rng(seed(std::move(rng_rvalue))), threshold(to_threshold(probability)), value(dropout_value) {}
+
+        dropout(const dropout& other) = default;
+        dropout(dropout&& other) = default;
+
+        dropout& operator=(const dropout& other) = default;
+        dropout& operator=(dropout&& other) = default;
+
+        std::size_t size_in() const {
+            return size;
+        }
+
+        std::size_t size_out() const {
+            return size;
+        }
+
+        state_t allocate_state() const {
+            return state_t(size);
+        }
+
+        weights_t allocate_delta_storage() const {
+            return weights_t{};
+        }
+
+        error_t allocate_error_storage() const {
+            return error_t(size);
+        }
+
+        /* Allocates batch state, its generator is seeded using the generator of the layer.
+         */
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return batch_state_t(size, batch_size, rng());
+        }
+
+        nntlib::storage::row_matrix<T> allocate_batch_error_storage(std::size_t batch_size) const {
+            return nntlib::storage::row_matrix<T>(size, batch_size);
+        }
+
+        /* Forward pass. The generator of the layer is only used during
+         * training, so inference can run concurrently.
+         */
+        template <typename InputIt>
+        nntlib::utils::undef forward(InputIt x_first, InputIt x_last, state_t& state, bool training) const {
+            if (!training) {
+                std::copy(x_first, x_last, state.begin());
+            } else {
+                fill_mask(state.mask.data(), size, rng);
+                const T* m = state.mask.data();
+                T* y = state.data();
+                for (std::size_t i = 0; (i < size) && (x_first != x_last); ++i, ++x_first) {
+                    y[i] = value + m[i] * (static_cast<T>(*x_first) - value);
+                }
+            }
+
+            return nntlib::utils::undef{};
+        }
+
+        template <typename InputIt, typename PrevError>
+        void backward(InputIt _x_first, InputIt _x_last, const state_t& y, const PrevError& prev_error, error_t& error_mem, weights_t& _gradient, nntlib::utils::undef) const {
+            const T* m = y.mask.data();
+            T* e = error_mem.data();
+            auto it = prev_error.begin();
+            for (std::size_t i = 0; i < size; ++i, ++it) {
+                e[i] = m[i] * (*it);
+            }
+        }
+
+        nntlib::utils::undef forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, batch_state_t& state, bool training) const {
+            if (!training) {
+                nntlib::storage::as_eigen(state, n) = nntlib::storage::as_eigen(x, n);
+                return nntlib::utils::undef{};
+            }
+
+            for (std::size_t j = 0; j < size; ++j) {
+                T* mj = state.mask[j].data();
+                fill_mask(mj, n, state.rng);
+
+                const T* xj = x[j].data();
+                T* yj = state[j].data();
+                for (std::size_t b = 0; b < n; ++b) {
+                    yj[b] = value + mj[b] * (xj[b] - value);
+                }
+            }
+
+            return nntlib::utils::undef{};
+        }
+
+        void backward_batch(const nntlib::storage::row_matrix<T>& _x, std::size_t n, const batch_state_t& state, nntlib::storage::row_matrix<T>& prev_error, nntlib::storage::row_matrix<T>& error_mem, weights_t& _gradient, nntlib::utils::undef) const {
+            nntlib::storage::as_eigen(error_mem, n) = nntlib::storage::as_eigen(prev_error, n).cwiseProduct(nntlib::storage::as_eigen(state.mask, n));
+        }
+
+        void update(const weights_t& _delta) {/* noop */}
+
+        const weights_t& get_weights() const {
+            return weights;
+        }
+
+        weights_t& get_weights() {
+            return weights;
+        }
+
+    private:
+        weights_t weights;
+        std::size_t size;
+        mutable generator_t rng;
+        std::uint32_t threshold;
+        T value;
+
+        /* Combines two draws (32 bits each, e.g. from std::mt19937) to a 64 bit seed.
+         */
+        static std::uint64_t seed(Rng&& generator) {
+            std::uint64_t hi = static_cast<std::uint64_t>(generator()) & 0xffffffffu;
+            std::uint64_t lo = static_cast<std::uint64_t>(generator()) & 0xffffffffu;
+            return (hi << 32) | lo;
+        }
+
+        /* Elements are kept if their 16 random bits are greater or equal to the threshold.
+         */
+        static std::uint32_t to_threshold(double probability) {
+            double t = std::round(probability * 65536.0);
+            return static_cast<std::uint32_t>(std::min(std::max(t, 0.0), 65536.0));
+        }
+
+        void fill_mask(T* mask, std::size_t n, generator_t& generator) const {
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                std::uint64_t bits = generator();
+                for (std::size_t k = 0; k < 4; ++k) {
+                    mask[i + k] = static_cast<T>(((bits >> (16 * k)) & 0xffffu) >= threshold);
+                }
+            }
+            if (i < n) {
+                std::uint64_t bits = generator();
+                for (std::size_t k = 0; i < n; ++i, ++k) {
+                    mask[i] = static_cast<T>(((bits >> (16 * k)) & 0xffffu) >= threshold);
+                }
+            }
+        }
 };
 
 }
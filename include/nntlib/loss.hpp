@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 
 namespace nntlib {
@@ -9,7 +11,7 @@ namespace loss {
 template <typename T = double>
 struct mse {
     static constexpr T f(T y, T t) {
-        constexpr T d = y - t;
+        T d = y - t;
         return d * d / 2.0;
     }
 
@@ -29,6 +31,24 @@ struct cross_entropy {
     }
 };
 
+/* Cross entropy of a softmax output, fused with the derivative of the softmax.
+ *
+ * Use together with <nntlib::activation::softmax_cross_entropy> as activation
+ * of the output layer and one-hot (or otherwise normalized) targets. The
+ * error of the output layer is then y - t, without any division or
+ * exponential.
+ */
+template <typename T = double>
+struct softmax_cross_entropy {
+    static constexpr T f(T y, T t) {
+        return -t * std::log(std::max(y, std::numeric_limits<T>::min()));
+    }
+
+    static constexpr T df(T y, T t) {
+        return y - t;
+    }
+};
+
 }
 }
 
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "storage.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+
+namespace nntlib {
+
+/* Contains a versioned binary format to store and load the weights of a net.
+ *
+ * A file consists of a 64 byte <header>, one <entry> per layer and the
+ * weights of every layer. The weights are stored with the same layout as in
+ * memory (rows padded to 64 bytes), so loading a layer is a single memcpy
+ * out of the mapped file. All values are stored in native byte order.
+ *
+ * Only layers with weight matrices can be stored, so nets with inference-only
+ * layers (<nntlib::layer::quantized_fully_connected>,
+ * <nntlib::layer::sparse_fully_connected>) cannot be saved. Store the trained
+ * net instead and convert its layers after loading.
+ */
+namespace model {
+
+/* Magic bytes at the beginning of every file.
+ */
+constexpr char magic[4] = {'N', 'N', 'T', 'M'};
+
+/* Current version of the format.
+ */
+constexpr std::uint32_t version = 1;
+
+/* Size of the header and alignment of all weight blocks in bytes.
+ */
+constexpr std::size_t block_alignment = 64;
+
+/* File header.
+ */
+struct header {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t type;
+    std::uint32_t n_layers;
+    std::uint64_t signature;
+};
+
+/* Shape and position of the weights of one layer.
+ */
+struct entry {
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t stride;
+    std::uint64_t offset;
+};
+
+static_assert(sizeof(header) <= block_alignment, "Header does not fit into the first block!");
+
+/* Private implementation details.
+ */
+namespace _ {
+template <typename Tuple, typename Function, std::size_t... Is>
+void tuple_apply_indexed(Tuple& tuple, Function& function, std::index_sequence<Is...>) {
+    int dummy[] = {0, (function(Is, std::get<Is>(tuple)), 0)...};
+    (void)dummy;
+}
+
+template <typename Tuple, typename Function>
+void tuple_apply_indexed(Tuple& tuple, Function function) {
+    tuple_apply_indexed(tuple, function, std::make_index_sequence<std::tuple_size<Tuple>::value>{});
+}
+
+template <typename Net>
+using value_t = typename std::decay<typename std::tuple_element<0, typename Net::weights_t>::type>::type::value_type;
+
+inline std::uint64_t fnv1a(std::uint64_t hash, const void* data, std::size_t n) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < n; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline std::size_t align(std::size_t offset) {
+    return (offset + block_alignment - 1) / block_alignment * block_alignment;
+}
+}
+
+/* Calculates the topology signature of a net.
+ * @net Net.
+ *
+ * The signature covers the net type (value type, loss, layer types including
+ * their activations) and the shapes of all weights. It is based on
+ * typeid(Net).name(), so it is only stable for the same compiler.
+ */
+template <typename Net>
+std::uint64_t signature(const Net& net) {
+    const char* name = typeid(Net).name();
+    std::uint64_t hash = _::fnv1a(14695981039346656037ull, name, std::strlen(name));
+
+    auto weights = net.weights_view();
+    _::tuple_apply_indexed(weights, [&](std::size_t _i, const auto& w){
+        std::uint64_t shape[2] = {w.rows(), w.cols()};
+        hash = _::fnv1a(hash, shape, sizeof(shape));
+    });
+
+    return hash;
+}
+
+/* Writes the weights of a net to a file.
+ * @net Net.
+ * @path Path of the file, gets overwritten.
+ *
+ * Throws std::system_error if the file cannot be written.
+ */
+template <typename Net>
+void save(const Net& net, const std::string& path) {
+    typedef _::value_t<Net> T;
+
+    auto weights = net.weights_view();
+    constexpr std::size_t n_layers = std::tuple_size<decltype(weights)>::value;
+
+    header head{};
+    std::memcpy(head.magic, magic, sizeof(magic));
+    head.version = version;
+    head.type = static_cast<std::uint32_t>(nntlib::storage::dtype_of<T>::value);
+    head.n_layers = n_layers;
+    head.signature = signature(net);
+
+    std::vector<entry> entries(n_layers);
+    std::size_t offset = _::align(block_alignment + n_layers * sizeof(entry));
+    _::tuple_apply_indexed(weights, [&](std::size_t i, const auto& w){
+        entries[i] = entry{w.rows(), w.cols(), w.stride(), offset};
+        offset = _::align(offset + w.buffer_size() * sizeof(T));
+    });
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+    }
+
+    char padding[block_alignment] = {};
+    out.write(reinterpret_cast<const char*>(&head), sizeof(header));
+    out.write(padding, block_alignment - sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(entry)));
+    _::tuple_apply_indexed(weights, [&](std::size_t i, const auto& w){
+        std::size_t pos = static_cast<std::size_t>(out.tellp());
+        out.write(padding, static_cast<std::streamsize>(entries[i].offset - pos));
+        out.write(reinterpret_cast<const char*>(w.data()), static_cast<std::streamsize>(w.buffer_size() * sizeof(T)));
+    });
+
+    out.flush();
+    if (!out) {
+        throw std::system_error(errno, std::generic_category(), "cannot write " + path);
+    }
+}
+
+/* Loads weights that were written by <save> into a net.
+ * @net Net, must have the same topology as the stored one.
+ * @path Path of the file.
+ *
+ * The file gets mapped and the weights of every layer are copied with a
+ * single memcpy. Throws std::system_error if the file cannot be mapped and
+ * std::runtime_error if it does not match the net.
+ */
+template <typename Net>
+void load(Net& net, const std::string& path) {
+    typedef _::value_t<Net> T;
+
+    nntlib::storage::mapped_file file(path);
+    auto weights = net.weights_view();
+    constexpr std::size_t n_layers = std::tuple_size<decltype(weights)>::value;
+
+    if (file.size() < block_alignment + n_layers * sizeof(entry)) {
+        throw std::runtime_error(path + " is not a model (too short)");
+    }
+
+    header head;
+    std::memcpy(&head, file.data(), sizeof(header));
+    if (std::memcmp(head.magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error(path + " is not a model (wrong magic)");
+    }
+    if (head.version != version) {
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(head.version));
+    }
+    if (head.type != static_cast<std::uint32_t>(nntlib::storage::dtype_of<T>::value)) {
+        throw std::runtime_error(path + " has a different value type");
+    }
+    if ((head.n_layers != n_layers) || (head.signature != signature(net))) {
+        throw std::runtime_error(path + " has a different topology");
+    }
+
+    std::vector<entry> entries(n_layers);
+    std::memcpy(entries.data(), file.data() + block_alignment, n_layers * sizeof(entry));
+
+    // check everything first, so the net stays untouched on errors
+    _::tuple_apply_indexed(weights, [&](std::size_t i, const auto& w){
+        const entry& e = entries[i];
+        if ((e.rows != w.rows()) || (e.cols != w.cols()) || (e.stride != w.stride())) {
+            throw std::runtime_error(path + " has a different shape in layer " + std::to_string(i));
+        }
+        if ((e.offset % block_alignment != 0) || (e.offset > file.size()) || ((file.size() - e.offset) / sizeof(T) < w.buffer_size())) {
+            throw std::runtime_error(path + " is truncated");
+        }
+    });
+
+    _::tuple_apply_indexed(weights, [&](std::size_t i, auto& w){
+        if (w.buffer_size() > 0) {
+            std::memcpy(w.data(), file.data() + entries[i].offset, w.buffer_size() * sizeof(T));
+        }
+    });
+
+    // layers that derive data from their weights (e.g. compact copies or pruning masks) have to rebuild it
+    net.reload();
+}
+
+}
+}
@@ -1,14 +1,46 @@
 #pragma once
 
+#include "instrumentation.hpp"
+#include "storage.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 
 namespace nntlib {
 
+/* Private implementation details.
+ */
+namespace _ {
+template <typename Layer>
+auto reload_layer(Layer& layer, int) -> decltype(layer.reload()) {
+    return layer.reload();
+}
+
+template <typename Layer>
+void reload_layer(Layer& layer, long) {
+    nntlib::utils::refresh_layer(layer);
+}
+
+/* Type of the input blocks of a layer, <nntlib::storage::row_matrix> unless the layer defines batch_input_t.
+ */
+template <typename Layer, typename T, typename = void>
+struct batch_input {
+    typedef nntlib::storage::row_matrix<T> type;
+};
+
+template <typename Layer, typename T>
+struct batch_input<Layer, T, decltype(std::declval<typename Layer::batch_input_t*>(), void())> {
+    typedef typename Layer::batch_input_t type;
+};
+}
+
 template <typename T, typename Loss, typename... Layers>
 class net {
     public:
@@ -17,67 +49,118 @@ class net {
         net(Layers&... layers);
 
         template <typename InputIt>
-        std::vector<T> forward(InputIt x_first, InputIt x_last) const;
+        auto forward(InputIt x_first, InputIt x_last) const;
 
         template <typename InputIt1, typename InputIt2>
-        std::pair<std::vector<T>, weights_t> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const;
+        auto backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const;
 
         template <typename Tuple, int N = 0>
         void update(const Tuple& weights);
+
+        std::size_t size_in() const;
+
+        std::size_t size_out() const;
+
+        nntlib::instrumentation::counters& instrumentation() const;
+
+        template <typename State, int N = 0>
+        nntlib::storage::row_matrix<T>& forward_batch(const nntlib::storage::row_matrix<T>& x, std::size_t n, State& state) const;
+
+        template <typename State, typename Error, typename Weights, int N = 0>
+        std::pair<nntlib::storage::row_matrix<T>&, Weights&> backward_batch(const nntlib::storage::row_matrix<T>& x, const nntlib::storage::row_matrix<T>& t, std::size_t n, State& state, Error& error_mem, Weights& gradient) const;
 };
 
 template <typename T, typename Loss, typename LayersLast>
-class net<T, Loss, LayersLast> {
+class net<T, Loss, LayersLast> : private nntlib::instrumentation::handle {
     public:
         typedef std::tuple<typename LayersLast::weights_t> weights_t;
-        typedef std::tuple<std::vector<T>> state_t;
-        typedef std::tuple<std::vector<T>, std::vector<T>> error_mem_t;
+        typedef std::tuple<typename LayersLast::state_t> state_t;
+        typedef std::tuple<typename LayersLast::error_t, typename LayersLast::state_t> error_mem_t;
+        typedef std::tuple<typename LayersLast::batch_state_t> batch_state_t;
+        typedef std::tuple<nntlib::storage::row_matrix<T>, nntlib::storage::row_matrix<T>> batch_error_mem_t;
+        typedef typename _::batch_input<LayersLast, T>::type batch_input_t;
+
+        net(LayersLast& layers_last) : net(nntlib::instrumentation::handle(), layers_last) {}
+
+        std::size_t size_in() const {
+            return last.size_in();
+        }
+
+        std::size_t size_out() const {
+            return last.size_out();
+        }
 
-        net(LayersLast& layers_last) : last(layers_last) {}
+        /* Per-layer counters of this net, shared with its copies. Stays empty without NNTLIB_INSTRUMENTATION, see <nntlib::instrumentation>.
+         */
+        nntlib::instrumentation::counters& instrumentation() const {
+            return get();
+        }
 
+        template <int N = 0>
         state_t allocate_state() const {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, allocate, 0);
             return std::make_tuple(last.allocate_state());
         }
 
+        template <int N = 0>
         error_mem_t allocate_error_storage() const {
-            return std::make_tuple(last.allocate_error_storage(), std::vector<T>(last.size_out()));
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, allocate, 0);
+            return std::make_tuple(last.allocate_error_storage(), last.allocate_state());
         }
 
+        template <int N = 0>
         weights_t allocate_delta_storage() const {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, allocate, 0);
             return std::make_tuple(last.allocate_delta_storage());
         }
 
+        template <int N = 0>
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, allocate, 0);
+            return std::make_tuple(last.allocate_batch_state(batch_size));
+        }
+
+        template <int N = 0>
+        batch_error_mem_t allocate_batch_error_storage(std::size_t batch_size) const {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, allocate, 0);
+            return std::make_tuple(last.allocate_batch_error_storage(batch_size), nntlib::storage::row_matrix<T>(last.size_out(), batch_size));
+        }
+
         template <typename InputIt>
-        std::vector<T> forward(InputIt x_first, InputIt x_last) const {
+        typename LayersLast::state_t forward(InputIt x_first, InputIt x_last) const {
             state_t state = allocate_state();
             forward(x_first, x_last, state);
             return std::get<0>(state);
         }
 
         template <typename InputIt, typename State, int N = 0>
-        std::vector<T>& forward(InputIt x_first, InputIt x_last, State& state) const {
-            std::vector<T>& y = std::get<N>(state);
+        typename LayersLast::state_t& forward(InputIt x_first, InputIt x_last, State& state) const {
+            auto& y = std::get<N>(state);
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, forward, 1);
             last.forward(x_first, x_last, y, false);
             return y;
         }
 
         template <typename InputIt1, typename InputIt2>
-        std::pair<std::vector<T>, weights_t> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const {
+        std::pair<typename LayersLast::error_t, weights_t> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const {
             state_t state = allocate_state();
             error_mem_t error_mem = allocate_error_storage();
             weights_t gradient = allocate_delta_storage();
 
             backward(x_first, x_last, t_first, t_last, state, error_mem, gradient);
 
-            return std::make_pair(std::move(error_mem), std::move(gradient));
+            return std::make_pair(std::move(std::get<0>(error_mem)), std::move(gradient));
         }
 
         template <typename InputIt1, typename InputIt2, typename State, typename Error, typename Weights, int N = 0>
-        std::pair<std::vector<T>&, Weights&> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last, State& state, Error& error_mem, Weights& gradient) const {
-            std::vector<T>& y = std::get<N>(state);
-            auto cache = last.forward(x_first, x_last, y, true);
-
-            std::vector<T>& error = std::get<N + 1>(error_mem);
+        std::pair<typename LayersLast::error_t&, Weights&> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last, State& state, Error& error_mem, Weights& gradient) const {
+            auto& y = std::get<N>(state);
+            auto cache = [&]{
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, forward, 1);
+                return last.forward(x_first, x_last, y, true);
+            }();
+
+            auto& error = std::get<N + 1>(error_mem);
             auto it = y.begin();
             auto end = y.end();
             std::size_t pos(0);
@@ -88,92 +171,271 @@ class net<T, Loss, LayersLast> {
                 ++t_first;
             }
 
-            last.backward(x_first, x_last, error, std::get<N>(error_mem), std::get<N>(gradient), cache);
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, backward, 1);
+            last.backward(x_first, x_last, y, error, std::get<N>(error_mem), std::get<N>(gradient), cache);
+            return std::make_pair(std::ref(std::get<N>(error_mem)), std::ref(gradient));
+        }
+
+        template <typename State, int N = 0>
+        nntlib::storage::row_matrix<T>& forward_batch(const batch_input_t& x, std::size_t n, State& state) const {
+            auto& y = std::get<N>(state);
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, forward, n);
+            last.forward_batch(x, n, y, false);
+            return y;
+        }
+
+        template <typename State, typename Error, typename Weights, int N = 0>
+        std::pair<nntlib::storage::row_matrix<T>&, Weights&> backward_batch(const batch_input_t& x, const nntlib::storage::row_matrix<T>& t, std::size_t n, State& state, Error& error_mem, Weights& gradient) const {
+            auto& y = std::get<N>(state);
+            auto cache = [&]{
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, forward, n);
+                return last.forward_batch(x, n, y, true);
+            }();
+
+            auto& error = std::get<N + 1>(error_mem);
+            const std::size_t rows = std::min(y.rows(), t.rows());
+            for (std::size_t j = 0; j < rows; ++j) {
+                const T* yj = y[j].data();
+                const T* tj = t[j].data();
+                T* ej = error[j].data();
+                for (std::size_t b = 0; b < n; ++b) {
+                    ej[b] = Loss::df(yj[b], tj[b]);
+                }
+            }
+
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, backward, n);
+            last.backward_batch(x, n, y, error, std::get<N>(error_mem), std::get<N>(gradient), cache);
             return std::make_pair(std::ref(std::get<N>(error_mem)), std::ref(gradient));
         }
 
         template <typename Tuple, int N = 0>
         void update(const Tuple& weights) {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, update, 0);
             last.update(std::get<N>(weights));
         }
 
+        /* Writes the weights of every layer using a function (e.g. a fused optimizer step) and refreshes the layer afterwards.
+         * @func Function void(weights_t& weights, parts&...) that gets called once per layer, with the weights of the layer and the part of every tuple that belongs to it.
+         * @tuples Tuples with one element per layer, e.g. gradients and optimizer state.
+         *
+         * Recorded as update of the layer, like <update>.
+         */
+        template <int N = 0, typename Function, typename... Tuples>
+        void apply_update(Function& func, Tuples&... tuples) {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, last, update, 0);
+            func(last.get_weights(), std::get<N>(tuples)...);
+            nntlib::utils::refresh_layer(last);
+        }
+
+        /* Lets layers rebuild data that is derived from their weights (e.g. compact copies), call it after writing weights via <weights_view>.
+         */
+        void refresh() {
+            nntlib::utils::refresh_layer(last);
+        }
+
+        /* Like <refresh>, but for weights that were replaced entirely (e.g. by <nntlib::model::load>). Layers may rebuild more than in <refresh>, e.g. the mask of <nntlib::layer::pruned>.
+         */
+        void reload() {
+            _::reload_layer(last, 0);
+        }
+
         auto get_weights() const {
             return std::make_tuple(last.get_weights());
         }
 
+        /* Like <get_weights>, but returns references instead of copies. Writable if the net is not const.
+         */
+        auto weights_view() const {
+            return std::tuple<const typename LayersLast::weights_t&>(last.get_weights());
+        }
+
+        auto weights_view() {
+            return std::tuple<typename LayersLast::weights_t&>(last.get_weights());
+        }
+
     private:
+        template <typename, typename, typename...>
+        friend class net;
+
         LayersLast& last;
+
+        net(const nntlib::instrumentation::handle& stats, LayersLast& layers_last) : nntlib::instrumentation::handle(stats), last(layers_last) {}
 };
 
 template <typename T, typename Loss, typename LayersHead, typename... LayersTail>
-class net<T, Loss, LayersHead, LayersTail...> {
+class net<T, Loss, LayersHead, LayersTail...> : private nntlib::instrumentation::handle {
     public:
-        typedef decltype(std::tuple_cat(std::tuple<typename LayersHead::weights_t>(), typename net<T, Loss, LayersTail...>::weights_t())) weights_t;
-        typedef decltype(std::tuple_cat(std::tuple<std::vector<T>>(), typename net<T, Loss, LayersTail...>::state_t())) state_t;
-        typedef decltype(std::tuple_cat(std::tuple<std::vector<T>>(), typename net<T, Loss, LayersTail...>::error_mem_t())) error_mem_t;
+        typedef decltype(std::tuple_cat(std::declval<std::tuple<typename LayersHead::weights_t>>(), std::declval<typename net<T, Loss, LayersTail...>::weights_t>())) weights_t;
+        typedef decltype(std::tuple_cat(std::declval<std::tuple<typename LayersHead::state_t>>(), std::declval<typename net<T, Loss, LayersTail...>::state_t>())) state_t;
+        typedef decltype(std::tuple_cat(std::declval<std::tuple<typename LayersHead::error_t>>(), std::declval<typename net<T, Loss, LayersTail...>::error_mem_t>())) error_mem_t;
+        typedef decltype(std::tuple_cat(std::declval<std::tuple<typename LayersHead::batch_state_t>>(), std::declval<typename net<T, Loss, LayersTail...>::batch_state_t>())) batch_state_t;
+        typedef decltype(std::tuple_cat(std::tuple<nntlib::storage::row_matrix<T>>(), typename net<T, Loss, LayersTail...>::batch_error_mem_t())) batch_error_mem_t;
+        typedef typename _::batch_input<LayersHead, T>::type batch_input_t;
+
+        net(LayersHead& layers_head, LayersTail&... layers_tail) : net(nntlib::instrumentation::handle(), layers_head, layers_tail...) {}
+
+        std::size_t size_in() const {
+            return head.size_in();
+        }
+
+        std::size_t size_out() const {
+            return tail.size_out();
+        }
 
-        net(LayersHead& layers_head, LayersTail&... layers_tail) : head(layers_head), tail(layers_tail...) {}
+        nntlib::instrumentation::counters& instrumentation() const {
+            return get();
+        }
 
+        template <int N = 0>
         state_t allocate_state() const {
-            return std::tuple_cat(std::make_tuple(head.allocate_state()), tail.allocate_state());
+            return std::tuple_cat(allocate_head<N>([&]{return head.allocate_state();}), tail.template allocate_state<N + 1>());
         }
 
+        template <int N = 0>
         error_mem_t allocate_error_storage() const {
-            return std::tuple_cat(std::make_tuple(head.allocate_error_storage()), tail.allocate_error_storage());
+            return std::tuple_cat(allocate_head<N>([&]{return head.allocate_error_storage();}), tail.template allocate_error_storage<N + 1>());
         }
 
+        template <int N = 0>
         weights_t allocate_delta_storage() const {
-            return std::tuple_cat(std::make_tuple(head.allocate_delta_storage()), tail.allocate_delta_storage());
+            return std::tuple_cat(allocate_head<N>([&]{return head.allocate_delta_storage();}), tail.template allocate_delta_storage<N + 1>());
+        }
+
+        template <int N = 0>
+        batch_state_t allocate_batch_state(std::size_t batch_size) const {
+            return std::tuple_cat(allocate_head<N>([&]{return head.allocate_batch_state(batch_size);}), tail.template allocate_batch_state<N + 1>(batch_size));
+        }
+
+        template <int N = 0>
+        batch_error_mem_t allocate_batch_error_storage(std::size_t batch_size) const {
+            return std::tuple_cat(allocate_head<N>([&]{return head.allocate_batch_error_storage(batch_size);}), tail.template allocate_batch_error_storage<N + 1>(batch_size));
         }
 
         template <typename InputIt>
-        std::vector<T> forward(InputIt x_first, InputIt x_last) const {
+        auto forward(InputIt x_first, InputIt x_last) const {
             state_t state = allocate_state();
             forward(x_first, x_last, state);
             return std::get<std::tuple_size<state_t>::value - 1>(state);
         }
 
         template <typename InputIt, typename State, int N = 0>
-        std::vector<T>& forward(InputIt x_first, InputIt x_last, State& state) const {
-            std::vector<T>& x_next = std::get<N>(state);
-            head.forward(x_first, x_last, x_next, false);
+        auto& forward(InputIt x_first, InputIt x_last, State& state) const {
+            auto& x_next = std::get<N>(state);
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, forward, 1);
+                head.forward(x_first, x_last, x_next, false);
+            }
             return tail.template forward<decltype(x_next.begin()), State, N + 1>(x_next.begin(), x_next.end(), state);
         }
 
         template <typename InputIt1, typename InputIt2>
-        std::pair<std::vector<T>, weights_t> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const {
+        std::pair<typename LayersHead::error_t, weights_t> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last) const {
             state_t state = allocate_state();
             error_mem_t error_mem = allocate_error_storage();
             weights_t gradient = allocate_delta_storage();
 
             backward(x_first, x_last, t_first, t_last, state, error_mem, gradient);
 
-            return std::make_pair(std::move(error_mem), std::move(gradient));
+            return std::make_pair(std::move(std::get<0>(error_mem)), std::move(gradient));
         }
 
         template <typename InputIt1, typename InputIt2, typename State, typename Error, typename Weights, int N = 0>
-        std::pair<std::vector<T>&, Weights&> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last, State& state, Error& error_mem, Weights& gradient) const {
-            std::vector<T>& x_next = std::get<N>(state);
-            auto cache = head.forward(x_first, x_last, x_next, true);
+        std::pair<typename LayersHead::error_t&, Weights&> backward(InputIt1 x_first, InputIt1 x_last, InputIt2 t_first, InputIt2 t_last, State& state, Error& error_mem, Weights& gradient) const {
+            auto& x_next = std::get<N>(state);
+            auto cache = [&]{
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, forward, 1);
+                return head.forward(x_first, x_last, x_next, true);
+            }();
 
             auto fix_tail = tail.template backward<decltype(x_next.begin()), InputIt2, State, Error, Weights, N + 1>(x_next.begin(), x_next.end(), t_first, t_last, state, error_mem, gradient);
-            head.backward(x_first, x_last, fix_tail.first, std::get<N>(error_mem), std::get<N>(gradient), cache);
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, backward, 1);
+                head.backward(x_first, x_last, x_next, fix_tail.first, std::get<N>(error_mem), std::get<N>(gradient), cache);
+            }
+            return std::make_pair(std::ref(std::get<N>(error_mem)), std::ref(gradient));
+        }
+
+        template <typename State, int N = 0>
+        nntlib::storage::row_matrix<T>& forward_batch(const batch_input_t& x, std::size_t n, State& state) const {
+            auto& x_next = std::get<N>(state);
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, forward, n);
+                head.forward_batch(x, n, x_next, false);
+            }
+            return tail.template forward_batch<State, N + 1>(x_next, n, state);
+        }
+
+        template <typename State, typename Error, typename Weights, int N = 0>
+        std::pair<nntlib::storage::row_matrix<T>&, Weights&> backward_batch(const batch_input_t& x, const nntlib::storage::row_matrix<T>& t, std::size_t n, State& state, Error& error_mem, Weights& gradient) const {
+            auto& x_next = std::get<N>(state);
+            auto cache = [&]{
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, forward, n);
+                return head.forward_batch(x, n, x_next, true);
+            }();
+
+            auto fix_tail = tail.template backward_batch<State, Error, Weights, N + 1>(x_next, t, n, state, error_mem, gradient);
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, backward, n);
+                head.backward_batch(x, n, x_next, fix_tail.first, std::get<N>(error_mem), std::get<N>(gradient), cache);
+            }
             return std::make_pair(std::ref(std::get<N>(error_mem)), std::ref(gradient));
         }
 
         template <typename Tuple, int N = 0>
         void update(const Tuple& weights) {
-            head.update(std::get<N>(weights));
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, update, 0);
+                head.update(std::get<N>(weights));
+            }
             tail.template update<Tuple, N + 1>(weights);
         }
 
+        template <int N = 0, typename Function, typename... Tuples>
+        void apply_update(Function& func, Tuples&... tuples) {
+            {
+                NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, update, 0);
+                func(head.get_weights(), std::get<N>(tuples)...);
+                nntlib::utils::refresh_layer(head);
+            }
+            tail.template apply_update<N + 1>(func, tuples...);
+        }
+
+        void refresh() {
+            nntlib::utils::refresh_layer(head);
+            tail.refresh();
+        }
+
+        void reload() {
+            _::reload_layer(head, 0);
+            tail.reload();
+        }
+
         auto get_weights() const {
             return std::tuple_cat(std::make_tuple(head.get_weights()), tail.get_weights());
         }
 
+        auto weights_view() const {
+            return std::tuple_cat(std::tuple<const typename LayersHead::weights_t&>(head.get_weights()), tail.weights_view());
+        }
+
+        auto weights_view() {
+            return std::tuple_cat(std::tuple<typename LayersHead::weights_t&>(head.get_weights()), tail.weights_view());
+        }
+
     private:
+        template <typename, typename, typename...>
+        friend class net;
+
         LayersHead& head;
         net<T, Loss, LayersTail...> tail;
+
+        net(const nntlib::instrumentation::handle& stats, LayersHead& layers_head, LayersTail&... layers_tail) : nntlib::instrumentation::handle(stats), head(layers_head), tail(stats, layers_tail...) {}
+
+        template <int N, typename Function>
+        auto allocate_head(Function allocate) const {
+            NNTLIB_INSTRUMENT_SCOPE(instrumentation(), N, head, allocate, 0);
+            return std::make_tuple(allocate());
+        }
 };
 
 template <typename T, typename Loss, typename... Layers>
@@ -181,5 +443,114 @@ net<T, Loss, Layers...> make_net(Layers&... layers) {
     return net<T, Loss, Layers...>(layers...);
 }
 
+/* Pool of preallocated states for concurrent inference.
+ * @Net Net type.
+ *
+ * The forward pass of a net does not modify any layer, so multiple threads
+ * can evaluate the same net concurrently as long as every thread uses its own
+ * state. This pool hands out such states and takes them back afterwards, so
+ * no memory gets allocated once the pool holds one state per concurrent
+ * caller. The net must not be trained while the pool is used.
+ *
+ * Usage: nntlib::state_pool<decltype(net)> pool(net, n_threads);
+ */
+template <typename Net>
+class state_pool {
+    public:
+        typedef typename Net::state_t state_t;
+
+        /* Exclusive access to one state, returns it to the pool on destruction.
+         */
+        class lease {
+            public:
+                lease(state_pool& parent, std::unique_ptr<state_t>&& leased) : pool(&parent), ptr(std::move(leased)) {}
+
+                lease(const lease& other) = delete;
+                lease(lease&& other) = default;
+
+                lease& operator=(const lease& other) = delete;
+                lease& operator=(lease&& other) = delete;
+
+                ~lease() {
+                    if (ptr) {
+                        pool->release(std::move(ptr));
+                    }
+                }
+
+                state_t& state() {
+                    return *ptr;
+                }
+
+            private:
+                state_pool* pool;
+                std::unique_ptr<state_t> ptr;
+        };
+
+        /* Creates new pool.
+         * @net Net that is used to allocate states and run the forward pass.
+         * @n_prealloc Number of states to allocate in advance, e.g. number of threads.
+         */
+        explicit state_pool(const Net& net, std::size_t n_prealloc = 0) : parent(net), n_allocated(0) {
+            for (std::size_t i = 0; i < n_prealloc; ++i) {
+                release(allocate());
+            }
+        }
+
+        state_pool(const state_pool& other) = delete;
+        state_pool(state_pool&& other) = delete;
+
+        state_pool& operator=(const state_pool& other) = delete;
+        state_pool& operator=(state_pool&& other) = delete;
+
+        /* Takes a state out of the pool, allocates a new one if the pool is empty.
+         */
+        lease acquire() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!free.empty()) {
+                    std::unique_ptr<state_t> ptr = std::move(free.back());
+                    free.pop_back();
+                    return lease(*this, std::move(ptr));
+                }
+            }
+            return lease(*this, allocate());
+        }
+
+        /* Thread-safe forward pass that copies the result.
+         * @x_first Begin of the input.
+         * @x_last End of the input.
+         * @y_first Begin of the output.
+         * @return End of the output.
+         */
+        template <typename InputIt, typename OutputIt>
+        OutputIt forward(InputIt x_first, InputIt x_last, OutputIt y_first) {
+            lease l = acquire();
+            const auto& y = parent.forward(x_first, x_last, l.state());
+            return std::copy(y.begin(), y.end(), y_first);
+        }
+
+    private:
+        const Net& parent;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<state_t>> free;
+        std::size_t n_allocated;
+
+        std::unique_ptr<state_t> allocate() {
+            std::unique_ptr<state_t> ptr(new state_t(parent.allocate_state()));
+
+            // make sure that returning states never allocates
+            std::lock_guard<std::mutex> lock(mutex);
+            ++n_allocated;
+            free.reserve(n_allocated);
+
+            return ptr;
+        }
+
+        void release(std::unique_ptr<state_t>&& ptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            free.push_back(std::move(ptr));
+        }
+};
+
 }
 
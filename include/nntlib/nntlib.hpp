@@ -1,10 +1,15 @@
 #pragma once
 
 #include "activation.hpp"
+#include "concurrency.hpp"
+#include "dataset.hpp"
+#include "instrumentation.hpp"
 #include "iterator.hpp"
 #include "layer.hpp"
 #include "loss.hpp"
+#include "model.hpp"
 #include "net.hpp"
+#include "storage.hpp"
 #include "training.hpp"
 #include "utils.hpp"
 
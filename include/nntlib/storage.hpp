@@ -0,0 +1,728 @@
+#pragma once
+
+#include "instrumentation.hpp"
+
+#include <eigen3/Eigen/Core>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <string>
+#include <system_error>
+#include <vector>
+
+
+namespace nntlib {
+
+/* Contains storage types that keep weights and states in cache friendly, contiguous memory.
+ */
+namespace storage {
+
+/* Default alignment of all buffers in bytes. Wide enough for AVX-512 registers and cache lines.
+ */
+constexpr std::size_t default_alignment = 64;
+
+/* Brain floating point format, i.e. the upper 16 bits of a float.
+ *
+ * Only used to store values, all calculations happen after the conversion
+ * to float. Conversion from float rounds to nearest even.
+ */
+class bfloat16 {
+    public:
+        bfloat16() : bits(0) {}
+
+        bfloat16(float value) : bits(round(value)) {}
+
+        operator float() const {
+            std::uint32_t u = static_cast<std::uint32_t>(bits) << 16;
+            float value;
+            std::memcpy(&value, &u, sizeof(value));
+            return value;
+        }
+
+    private:
+        std::uint16_t bits;
+
+        static std::uint16_t round(float value) {
+            std::uint32_t u;
+            std::memcpy(&u, &value, sizeof(u));
+            if ((u & 0x7fffffffu) > 0x7f800000u) {
+                // keep NaNs quiet instead of rounding them to infinity
+                return static_cast<std::uint16_t>((u >> 16) | 0x40u);
+            }
+            u += 0x7fffu + ((u >> 16) & 1u);
+            return static_cast<std::uint16_t>(u >> 16);
+        }
+};
+
+/* Allocator that returns memory aligned to a fixed boundary.
+ * @T Value type.
+ * @Align Alignment in bytes, must be a power of 2.
+ */
+template <typename T, std::size_t Align = default_alignment>
+class aligned_allocator {
+    static_assert((Align & (Align - 1)) == 0, "Align must be a power of 2!");
+
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef aligned_allocator<U, Align> other;
+        };
+
+        aligned_allocator() = default;
+
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U, Align>& _other) {}
+
+        T* allocate(std::size_t n) {
+            NNTLIB_INSTRUMENT_ALLOCATION(n * sizeof(T));
+
+            // over-allocate and store the original pointer right in front of the aligned block
+            void* raw = ::operator new(n * sizeof(T) + Align + sizeof(void*));
+            std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+            addr = (addr + Align - 1) & ~static_cast<std::uintptr_t>(Align - 1);
+            reinterpret_cast<void**>(addr)[-1] = raw;
+            return reinterpret_cast<T*>(addr);
+        }
+
+        void deallocate(T* ptr, std::size_t _n) {
+            ::operator delete(reinterpret_cast<void**>(ptr)[-1]);
+        }
+
+        template <typename U>
+        bool operator==(const aligned_allocator<U, Align>& _other) const {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const aligned_allocator<U, Align>& _other) const {
+            return false;
+        }
+};
+
+/* Non-owning view of a single matrix row.
+ * @T Value type, might be const.
+ */
+template <typename T>
+class row_view {
+    public:
+        typedef T value_type;
+        typedef T* iterator;
+
+        row_view(T* ptr, std::size_t n) : first(ptr), length(n) {}
+
+        T* begin() const {
+            return first;
+        }
+
+        T* end() const {
+            return first + length;
+        }
+
+        T* data() const {
+            return first;
+        }
+
+        std::size_t size() const {
+            return length;
+        }
+
+        T& operator[](std::size_t i) const {
+            return first[i];
+        }
+
+    private:
+        T* first;
+        std::size_t length;
+
+        template <typename U>
+        friend class row_iterator;
+};
+
+/* Iterator over the rows of a <row_matrix>, yields <row_view> objects.
+ * @T Value type, might be const.
+ *
+ * The yielded view is stored within the iterator, so references to it become
+ * invalid as soon as the iterator gets incremented.
+ */
+template <typename T>
+class row_iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::ptrdiff_t difference_type;
+        typedef row_view<T> value_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        row_iterator(T* ptr, std::size_t cols, std::size_t row_stride) : current(ptr, cols), stride(row_stride) {}
+
+        row_iterator& operator++() {
+            current.first += stride;
+            return *this;
+        }
+
+        reference operator*() const {
+            return current;
+        }
+
+        pointer operator->() const {
+            return &current;
+        }
+
+        bool operator==(const row_iterator& other) const {
+            return this->current.first == other.current.first;
+        }
+
+        bool operator!=(const row_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        value_type current;
+        std::size_t stride;
+};
+
+/* Dense row-major matrix backed by a single aligned buffer.
+ * @T Value type.
+ * @Align Alignment of the buffer and of every row in bytes.
+ *
+ * Every row starts at an aligned address, i.e. rows are padded to a multiple
+ * of the SIMD width. Padding elements are always zero, so element-wise
+ * operations might run over the entire buffer (see <data> and <buffer_size>).
+ * Two matrices of the same shape always share the same layout.
+ *
+ * Iterating over the matrix yields <row_view> objects, so it can be used
+ * like a nested container (e.g. std::vector<std::vector<T>>).
+ */
+template <typename T, std::size_t Align = default_alignment>
+class row_matrix {
+    public:
+        typedef T value_type;
+        typedef row_view<T> row_t;
+        typedef row_view<const T> const_row_t;
+        typedef row_iterator<T> iterator;
+        typedef row_iterator<const T> const_iterator;
+
+        row_matrix() : n_rows(0), n_cols(0), n_stride(0) {}
+
+        /* Creates new zero-initialized matrix.
+         * @rows Number of rows.
+         * @cols Number of (logical) columns.
+         */
+        row_matrix(std::size_t rows, std::size_t cols) : n_rows(rows), n_cols(cols), n_stride(padded(cols)), buffer(rows * n_stride, T(0)) {}
+
+        row_matrix(const row_matrix& other) = default;
+        row_matrix(row_matrix&& other) = default;
+
+        row_matrix& operator=(const row_matrix& other) = default;
+        row_matrix& operator=(row_matrix&& other) = default;
+
+        /* Number of rows.
+         */
+        std::size_t rows() const {
+            return n_rows;
+        }
+
+        /* Number of (logical) columns.
+         */
+        std::size_t cols() const {
+            return n_cols;
+        }
+
+        /* Distance between two rows in elements.
+         */
+        std::size_t stride() const {
+            return n_stride;
+        }
+
+        /* Number of rows, for compatibility with nested containers.
+         */
+        std::size_t size() const {
+            return n_rows;
+        }
+
+        bool empty() const {
+            return n_rows == 0;
+        }
+
+        /* Number of elements in the underlying buffer, including padding.
+         */
+        std::size_t buffer_size() const {
+            return buffer.size();
+        }
+
+        T* data() {
+            return buffer.data();
+        }
+
+        const T* data() const {
+            return buffer.data();
+        }
+
+        row_t operator[](std::size_t j) {
+            return row_t(data() + j * n_stride, n_cols);
+        }
+
+        const_row_t operator[](std::size_t j) const {
+            return const_row_t(data() + j * n_stride, n_cols);
+        }
+
+        T& operator()(std::size_t j, std::size_t i) {
+            return buffer[j * n_stride + i];
+        }
+
+        const T& operator()(std::size_t j, std::size_t i) const {
+            return buffer[j * n_stride + i];
+        }
+
+        iterator begin() {
+            return iterator(data(), n_cols, n_stride);
+        }
+
+        iterator end() {
+            return iterator(data() + n_rows * n_stride, n_cols, n_stride);
+        }
+
+        const_iterator begin() const {
+            return const_iterator(data(), n_cols, n_stride);
+        }
+
+        const_iterator end() const {
+            return const_iterator(data() + n_rows * n_stride, n_cols, n_stride);
+        }
+
+        /* Sets all (logical) elements to a value, padding stays zero.
+         */
+        void fill(T value) {
+            for (auto& row : *this) {
+                std::fill(row.begin(), row.end(), value);
+            }
+        }
+
+        /* Copies a sample into a column, e.g. to build a batch block with one column per sample.
+         * @i Column index.
+         * @first Begin of the sample.
+         * @last End of the sample.
+         *
+         * Missing elements are set to zero, surplus elements are ignored.
+         */
+        template <typename InputIt>
+        void assign_col(std::size_t i, InputIt first, InputIt last) {
+            T* ptr = data() + i;
+            std::size_t j = 0;
+            for (; (first != last) && (j < n_rows); ++first) {
+                ptr[j * n_stride] = *first;
+                ++j;
+            }
+            for (; j < n_rows; ++j) {
+                ptr[j * n_stride] = 0;
+            }
+        }
+
+        /* Calculates the row stride for a given number of columns.
+         */
+        static constexpr std::size_t padded(std::size_t cols) {
+            return (cols + lanes - 1) / lanes * lanes;
+        }
+
+    private:
+        static constexpr std::size_t lanes = (Align >= sizeof(T)) ? (Align / sizeof(T)) : 1;
+
+        std::size_t n_rows;
+        std::size_t n_cols;
+        std::size_t n_stride;
+        std::vector<T, aligned_allocator<T, Align>> buffer;
+};
+
+/* Dense row-major matrix with compile-time size, backed by a std::array.
+ * @T Value type.
+ * @Rows Number of rows.
+ * @Cols Number of (logical) columns.
+ * @Align Row padding in bytes.
+ *
+ * Same layout and interface as <row_matrix>, but does not use the heap. The
+ * buffer itself is not over-aligned: the matrix often ends up on the heap
+ * (e.g. in a state or worker cache) and C++14 does not support over-aligned
+ * types there, so all accesses have to work with unaligned data.
+ */
+template <typename T, std::size_t Rows, std::size_t Cols, std::size_t Align = default_alignment>
+class fixed_row_matrix {
+    public:
+        typedef T value_type;
+        typedef row_view<T> row_t;
+        typedef row_view<const T> const_row_t;
+        typedef row_iterator<T> iterator;
+        typedef row_iterator<const T> const_iterator;
+
+        /* Creates new zero-initialized matrix.
+         */
+        fixed_row_matrix() {
+            buffer.fill(T(0));
+        }
+
+        fixed_row_matrix(const fixed_row_matrix& other) = default;
+        fixed_row_matrix(fixed_row_matrix&& other) = default;
+
+        fixed_row_matrix& operator=(const fixed_row_matrix& other) = default;
+        fixed_row_matrix& operator=(fixed_row_matrix&& other) = default;
+
+        static constexpr std::size_t rows() {
+            return Rows;
+        }
+
+        static constexpr std::size_t cols() {
+            return Cols;
+        }
+
+        static constexpr std::size_t stride() {
+            return row_matrix<T, Align>::padded(Cols);
+        }
+
+        static constexpr std::size_t size() {
+            return Rows;
+        }
+
+        static constexpr bool empty() {
+            return Rows == 0;
+        }
+
+        static constexpr std::size_t buffer_size() {
+            return Rows * stride();
+        }
+
+        T* data() {
+            return buffer.data();
+        }
+
+        const T* data() const {
+            return buffer.data();
+        }
+
+        row_t operator[](std::size_t j) {
+            return row_t(data() + j * stride(), Cols);
+        }
+
+        const_row_t operator[](std::size_t j) const {
+            return const_row_t(data() + j * stride(), Cols);
+        }
+
+        T& operator()(std::size_t j, std::size_t i) {
+            return buffer[j * stride() + i];
+        }
+
+        const T& operator()(std::size_t j, std::size_t i) const {
+            return buffer[j * stride() + i];
+        }
+
+        iterator begin() {
+            return iterator(data(), Cols, stride());
+        }
+
+        iterator end() {
+            return iterator(data() + Rows * stride(), Cols, stride());
+        }
+
+        const_iterator begin() const {
+            return const_iterator(data(), Cols, stride());
+        }
+
+        const_iterator end() const {
+            return const_iterator(data() + Rows * stride(), Cols, stride());
+        }
+
+        /* Sets all (logical) elements to a value, padding stays zero.
+         */
+        void fill(T value) {
+            for (auto& row : *this) {
+                std::fill(row.begin(), row.end(), value);
+            }
+        }
+
+    private:
+        std::array<T, Rows * row_matrix<T, Align>::padded(Cols)> buffer;
+};
+
+/* <row_matrix> that is used as batch state of layers, one column per sample.
+ * @T Value type.
+ * @Align Alignment of the buffer and of every row in bytes.
+ *
+ * Also carries a buffer with one element per row, so activations that work on
+ * entire samples (e.g. softmax) can process contiguous copies of the columns
+ * without allocating memory.
+ */
+template <typename T, std::size_t Align = default_alignment>
+class batch_matrix : public row_matrix<T, Align> {
+    public:
+        batch_matrix() = default;
+
+        /* Creates new zero-initialized matrix.
+         * @rows Number of rows.
+         * @cols Number of (logical) columns.
+         */
+        batch_matrix(std::size_t rows, std::size_t cols) : row_matrix<T, Align>(rows, cols), column(rows) {}
+
+        /* Buffer for a single column.
+         */
+        std::vector<T, aligned_allocator<T, Align>> column;
+};
+
+/* <row_matrix> that tracks which rows were written, e.g. a sparse gradient.
+ * @T Value type.
+ * @Align Alignment of the buffer and of every row in bytes.
+ *
+ * Rows that get written via <touch> are recorded, so updates only have to
+ * visit these rows. It can still be used like a dense <row_matrix>.
+ */
+template <typename T, std::size_t Align = default_alignment>
+class sparse_rows : public row_matrix<T, Align> {
+    public:
+        sparse_rows() = default;
+
+        /* Creates new zero-initialized matrix without any touched rows.
+         * @rows Number of rows.
+         * @cols Number of (logical) columns.
+         */
+        sparse_rows(std::size_t rows, std::size_t cols) : row_matrix<T, Align>(rows, cols) {}
+
+        /* Marks a row as touched.
+         * @j Row index.
+         * @return Pointer to the first element of the row.
+         */
+        T* touch(std::size_t j) {
+            if (touched.empty()) {
+                touched.resize(this->rows(), 0);
+            }
+            if (!touched[j]) {
+                touched[j] = 1;
+                active.push_back(j);
+            }
+            return this->data() + j * this->stride();
+        }
+
+        /* Indices of all touched rows, in order of their first <touch>.
+         */
+        const std::vector<std::size_t>& touched_rows() const {
+            return active;
+        }
+
+        /* Sets all touched rows to zero and forgets them.
+         */
+        void clear() {
+            for (std::size_t j : active) {
+                std::fill_n(this->data() + j * this->stride(), this->cols(), T(0));
+                touched[j] = 0;
+            }
+            active.clear();
+        }
+
+    private:
+        std::vector<std::uint8_t> touched;
+        std::vector<std::size_t> active;
+};
+
+/* Block of sparse samples, stored column by column (compressed sparse columns).
+ * @T Value type.
+ *
+ * Used instead of a dense <row_matrix> to pass batches of sparse samples to a
+ * net (see <nntlib::layer::sparse_input>). Every sample is a sequence of
+ * (index, value) pairs.
+ */
+template <typename T>
+class sparse_block {
+    public:
+        typedef T value_type;
+
+        sparse_block() : n_rows(0), n_cols(0) {}
+
+        /* Creates new, empty block.
+         * @rows Number of (logical) rows, i.e. dimension of the samples.
+         * @cols Maximum number of samples.
+         */
+        sparse_block(std::size_t rows, std::size_t cols) : n_rows(rows), n_cols(cols), offsets(cols + 1, 0) {}
+
+        std::size_t rows() const {
+            return n_rows;
+        }
+
+        std::size_t cols() const {
+            return n_cols;
+        }
+
+        /* Stores a sample in column i, columns must be assigned in order (assigning column 0 clears the block).
+         * @i Column index.
+         * @first Begin of the sample, must yield (index, value) pairs.
+         * @last End of the sample.
+         *
+         * Pairs with an index outside of the rows are ignored.
+         */
+        template <typename InputIt>
+        void assign_col(std::size_t i, InputIt first, InputIt last) {
+            if (i == 0) {
+                indices.clear();
+                values.clear();
+            }
+            offsets[i] = indices.size();
+            for (; first != last; ++first) {
+                if (static_cast<std::size_t>(first->first) < n_rows) {
+                    indices.push_back(static_cast<std::uint32_t>(first->first));
+                    values.push_back(static_cast<T>(first->second));
+                }
+            }
+            offsets[i + 1] = indices.size();
+        }
+
+        /* Number of pairs of sample i.
+         */
+        std::size_t nnz(std::size_t i) const {
+            return offsets[i + 1] - offsets[i];
+        }
+
+        /* Indices of sample i.
+         */
+        const std::uint32_t* col_indices(std::size_t i) const {
+            return indices.data() + offsets[i];
+        }
+
+        /* Values of sample i.
+         */
+        const T* col_values(std::size_t i) const {
+            return values.data() + offsets[i];
+        }
+
+    private:
+        std::size_t n_rows;
+        std::size_t n_cols;
+        std::vector<std::size_t> offsets;
+        std::vector<std::uint32_t> indices;
+        std::vector<T> values;
+};
+
+/* Eigen view of a <row_matrix>.
+ */
+template <typename T>
+using eigen_map_t = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, Eigen::Unaligned, Eigen::OuterStride<>>;
+
+/* Read-only Eigen view of a <row_matrix>.
+ */
+template <typename T>
+using eigen_const_map_t = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, Eigen::Unaligned, Eigen::OuterStride<>>;
+
+/* Maps the first columns of a matrix (<row_matrix> or <fixed_row_matrix>) to Eigen, e.g. to use its matrix products.
+ * @m Matrix.
+ * @cols Number of columns to map, must not exceed m.cols().
+ */
+template <typename Matrix>
+eigen_map_t<typename Matrix::value_type> as_eigen(Matrix& m, std::size_t cols) {
+    return eigen_map_t<typename Matrix::value_type>(m.data(), m.rows(), cols, Eigen::OuterStride<>(m.stride()));
+}
+
+template <typename Matrix>
+eigen_const_map_t<typename Matrix::value_type> as_eigen(const Matrix& m, std::size_t cols) {
+    return eigen_const_map_t<typename Matrix::value_type>(m.data(), m.rows(), cols, Eigen::OuterStride<>(m.stride()));
+}
+
+template <typename Matrix>
+eigen_map_t<typename Matrix::value_type> as_eigen(Matrix& m) {
+    return as_eigen(m, m.cols());
+}
+
+template <typename Matrix>
+eigen_const_map_t<typename Matrix::value_type> as_eigen(const Matrix& m) {
+    return as_eigen(m, m.cols());
+}
+
+/* Value type tag of binary files.
+ */
+enum class dtype : std::uint32_t {
+    float32 = 1,
+    float64 = 2
+};
+
+template <typename T>
+struct dtype_of;
+
+template <>
+struct dtype_of<float> {
+    static constexpr dtype value = dtype::float32;
+};
+
+template <>
+struct dtype_of<double> {
+    static constexpr dtype value = dtype::float64;
+};
+
+/* Read-only memory mapping of an entire file (POSIX only).
+ *
+ * Throws std::system_error if the file cannot be mapped.
+ */
+class mapped_file {
+    public:
+        explicit mapped_file(const std::string& path) : base(nullptr), length(0) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+            }
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "cannot stat " + path);
+            }
+            length = static_cast<std::size_t>(st.st_size);
+
+            if (length > 0) {
+                void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+                int err = errno;
+                ::close(fd);
+                if (ptr == MAP_FAILED) {
+                    throw std::system_error(err, std::generic_category(), "cannot map " + path);
+                }
+                base = static_cast<const char*>(ptr);
+            } else {
+                ::close(fd);
+            }
+        }
+
+        mapped_file(const mapped_file& other) = delete;
+        mapped_file(mapped_file&& other) : base(other.base), length(other.length) {
+            other.base = nullptr;
+            other.length = 0;
+        }
+
+        mapped_file& operator=(const mapped_file& other) = delete;
+        mapped_file& operator=(mapped_file&& other) = delete;
+
+        ~mapped_file() {
+            if (base != nullptr) {
+                ::munmap(const_cast<char*>(base), length);
+            }
+        }
+
+        const char* data() const {
+            return base;
+        }
+
+        std::size_t size() const {
+            return length;
+        }
+
+    private:
+        const char* base;
+        std::size_t length;
+};
+
+}
+}
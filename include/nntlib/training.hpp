@@ -1,13 +1,25 @@
 #pragma once
 
+#include "concurrency.hpp"
+#include "storage.hpp"
 #include "utils.hpp"
 
 #include <eigen3/Eigen/Core>
 
 #include <cmath>
 
+#include <algorithm>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <iterator>
 #include <list>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 namespace nntlib {
@@ -15,6 +27,222 @@ namespace nntlib {
 namespace training {
 
 namespace _ {
+/* Scales a gradient in place and subtracts the l2 term, skips the first weight of every row (= bias value).
+ * @gradient Gradient matrix.
+ * @weights Current weights, same shape as the gradient.
+ * @scale Scaling factor.
+ * @l2 L2 factor, already divided by the number of samples.
+ */
+template <typename Matrix, typename Weights, typename T>
+void scale_and_regularize(Matrix& gradient, const Weights& weights, T scale, T l2) {
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j = 0; j < gradient.rows(); ++j) {
+        T* g = gradient[j].data();
+        const T* w = weights[j].data();
+
+        if (cols > 0) {
+            g[0] *= scale;
+        }
+        if (l2 > 0.0) {
+            for (std::size_t i = 1; i < cols; ++i) {
+                g[i] = g[i] * scale - w[i] * l2;
+            }
+        } else {
+            for (std::size_t i = 1; i < cols; ++i) {
+                g[i] *= scale;
+            }
+        }
+    }
+}
+
+/* Sparse version of <scale_and_regularize>, only visits the touched rows. The first row holds the bias values.
+ */
+template <typename T, std::size_t Align>
+void scale_and_regularize(nntlib::storage::sparse_rows<T, Align>& gradient, const nntlib::storage::sparse_rows<T, Align>& weights, T scale, T l2) {
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j : gradient.touched_rows()) {
+        T* g = gradient[j].data();
+        const T* w = weights[j].data();
+        const T l2_j = (j > 0) ? l2 : T(0);
+        for (std::size_t i = 0; i < cols; ++i) {
+            g[i] = g[i] * scale - w[i] * l2_j;
+        }
+    }
+}
+
+/* Adds one slice of a gradient to another one, used to sum up the gradients of multiple threads.
+ * @lhs Sum.
+ * @rhs Summand.
+ * @parts Number of slices.
+ * @i Index of the slice.
+ */
+template <typename Matrix>
+void add_gradient(Matrix& lhs, const Matrix& rhs, std::size_t parts, std::size_t i) {
+    typedef typename Matrix::value_type T;
+
+    auto range = nntlib::concurrency::split_range(lhs.buffer_size(), parts, i);
+    T* l = lhs.data();
+    const T* r = rhs.data();
+    for (std::size_t k = range.first; k < range.second; ++k) {
+        l[k] += r[k];
+    }
+}
+
+/* Sparse version of <add_gradient>, the touched rows are merged by the first slice.
+ */
+template <typename T, std::size_t Align>
+void add_gradient(nntlib::storage::sparse_rows<T, Align>& lhs, const nntlib::storage::sparse_rows<T, Align>& rhs, std::size_t _parts, std::size_t i) {
+    if (i != 0) {
+        return;
+    }
+
+    const std::size_t cols = lhs.cols();
+    for (std::size_t j : rhs.touched_rows()) {
+        T* l = lhs.touch(j);
+        const T* r = rhs[j].data();
+        for (std::size_t k = 0; k < cols; ++k) {
+            l[k] += r[k];
+        }
+    }
+}
+
+/* Marks an entire gradient as written, required for sparse gradients that were filled as a whole.
+ */
+template <typename Matrix>
+void touch_all(Matrix& _gradient) {/* noop */}
+
+template <typename T, std::size_t Align>
+void touch_all(nntlib::storage::sparse_rows<T, Align>& gradient) {
+    for (std::size_t j = 0; j < gradient.rows(); ++j) {
+        gradient.touch(j);
+    }
+}
+
+/* Fused momentum update: scales the gradient, adds the l2 term, updates the velocity and writes the weights in a single pass.
+ * @gradient Gradient sum of the batch.
+ * @weights Weights, get updated.
+ * @velocity Velocity, same shape as the weights.
+ * @scale Scaling factor of the gradient (= -learning rate / batch size).
+ * @l2 L2 factor, already divided by the number of samples.
+ * @mu Momentum.
+ * @nesterov Use Nesterov momentum.
+ */
+template <typename Matrix, typename Weights, typename T>
+void momentum_step(const Matrix& gradient, Weights& weights, Matrix& velocity, T scale, T l2, T mu, bool nesterov) {
+    // plain: w += v, nesterov: w += mu * v + d
+    const T fv = nesterov ? mu : T(1);
+    const T fd = nesterov ? T(1) : T(0);
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j = 0; j < gradient.rows(); ++j) {
+        const T* g = gradient[j].data();
+        T* w = weights[j].data();
+        T* v = velocity[j].data();
+
+        auto step = [&](std::size_t i, T l2_i) {
+            T d = g[i] * scale - w[i] * l2_i;
+            v[i] = mu * v[i] + d;
+            w[i] += fv * v[i] + fd * d;
+        };
+
+        // no l2 term for the bias value
+        if (cols > 0) {
+            step(0, T(0));
+        }
+        for (std::size_t i = 1; i < cols; ++i) {
+            step(i, l2);
+        }
+    }
+}
+
+/* Sparse version of <momentum_step>, only visits the touched rows. The first row holds the bias values.
+ *
+ * The update is lazy: the velocity of rows without a gradient does neither
+ * decay nor get applied to the weights until the row gets touched again.
+ */
+template <typename T, std::size_t Align>
+void momentum_step(const nntlib::storage::sparse_rows<T, Align>& gradient, nntlib::storage::sparse_rows<T, Align>& weights, nntlib::storage::sparse_rows<T, Align>& velocity, T scale, T l2, T mu, bool nesterov) {
+    const T fv = nesterov ? mu : T(1);
+    const T fd = nesterov ? T(1) : T(0);
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j : gradient.touched_rows()) {
+        const T* g = gradient[j].data();
+        T* w = weights[j].data();
+        T* v = velocity[j].data();
+        const T l2_j = (j > 0) ? l2 : T(0);
+        for (std::size_t i = 0; i < cols; ++i) {
+            T d = g[i] * scale - w[i] * l2_j;
+            v[i] = mu * v[i] + d;
+            w[i] += fv * v[i] + fd * d;
+        }
+    }
+}
+
+/* Fused Adam update: scales the gradient, adds the l2 term, updates both moments and writes the weights in a single pass.
+ * @gradient Gradient sum of the batch.
+ * @weights Weights, get updated.
+ * @m First moment, same shape as the weights.
+ * @v Second moment, same shape as the weights.
+ * @lr Learning rate.
+ * @scale Scaling factor of the gradient (= 1 / batch size).
+ * @l2_coupled L2 factor that is added to the gradient (Adam), already divided by the number of samples.
+ * @l2_decoupled Weight decay that is applied to the weights directly (AdamW), gets multiplied by the learning rate.
+ * @beta1 Decay of the first moment.
+ * @beta2 Decay of the second moment.
+ * @c1 Bias correction of the first moment.
+ * @c2 Bias correction of the second moment.
+ * @eps Term that avoids divisions by zero.
+ */
+template <typename Matrix, typename Weights, typename T>
+void adam_step(const Matrix& gradient, Weights& weights, Matrix& m, Matrix& v, T lr, T scale, T l2_coupled, T l2_decoupled, T beta1, T beta2, T c1, T c2, T eps) {
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j = 0; j < gradient.rows(); ++j) {
+        const T* g = gradient[j].data();
+        T* w = weights[j].data();
+        T* mj = m[j].data();
+        T* vj = v[j].data();
+
+        auto step = [&](std::size_t i, T l2c, T l2d) {
+            T gi = g[i] * scale + w[i] * l2c;
+            mj[i] = beta1 * mj[i] + (T(1) - beta1) * gi;
+            vj[i] = beta2 * vj[i] + (T(1) - beta2) * gi * gi;
+            w[i] -= lr * ((mj[i] * c1) / (std::sqrt(vj[i] * c2) + eps) + w[i] * l2d);
+        };
+
+        // no l2 term for the bias value
+        if (cols > 0) {
+            step(0, T(0), T(0));
+        }
+        for (std::size_t i = 1; i < cols; ++i) {
+            step(i, l2_coupled, l2_decoupled);
+        }
+    }
+}
+
+/* Sparse version of <adam_step>, only visits the touched rows. The first row holds the bias values.
+ *
+ * The update is lazy: the moments of rows without a gradient do not decay
+ * and the weight decay of these rows gets skipped until they get touched
+ * again. The bias correction still uses the global number of steps.
+ */
+template <typename T, std::size_t Align>
+void adam_step(const nntlib::storage::sparse_rows<T, Align>& gradient, nntlib::storage::sparse_rows<T, Align>& weights, nntlib::storage::sparse_rows<T, Align>& m, nntlib::storage::sparse_rows<T, Align>& v, T lr, T scale, T l2_coupled, T l2_decoupled, T beta1, T beta2, T c1, T c2, T eps) {
+    const std::size_t cols = gradient.cols();
+    for (std::size_t j : gradient.touched_rows()) {
+        const T* g = gradient[j].data();
+        T* w = weights[j].data();
+        T* mj = m[j].data();
+        T* vj = v[j].data();
+        const T l2c = (j > 0) ? l2_coupled : T(0);
+        const T l2d = (j > 0) ? l2_decoupled : T(0);
+        for (std::size_t i = 0; i < cols; ++i) {
+            T gi = g[i] * scale + w[i] * l2c;
+            mj[i] = beta1 * mj[i] + (T(1) - beta1) * gi;
+            vj[i] = beta2 * vj[i] + (T(1) - beta2) * gi * gi;
+            w[i] -= lr * ((mj[i] * c1) / (std::sqrt(vj[i] * c2) + eps) + w[i] * l2d);
+        }
+    }
+}
+
 template <typename T>
 class batch_template {
     public:
@@ -34,7 +262,14 @@ class batch_template {
             };
         }
 
-        batch_template(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0) : ffactor(func_factor), fround([](std::size_t _r){}), fbatch([](){}), bsize(batch_size), rounds(n_rounds), l2_factor(l2) {}
+        /* Creates new trainer.
+         * @func_factor Learning rate depending on the round.
+         * @batch_size Number of samples per update.
+         * @n_rounds Number of rounds over the entire training set.
+         * @l2 L2 regularization factor.
+         * @n_threads Number of threads that calculate gradients in parallel.
+         */
+        batch_template(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) : ffactor(func_factor), fround([](std::size_t _r){}), fbatch([](){}), bsize(batch_size), rounds(n_rounds), l2_factor(l2), threads(std::max<std::size_t>(1, n_threads)), shuffle_block(0) {}
         virtual ~batch_template() = default;
 
         virtual void callback_round(func_callback_round_t callback) {
@@ -45,66 +280,266 @@ class batch_template {
             fbatch = callback;
         }
 
+        /* Visits the training set in a new random order every round instead of iterator order.
+         * @block_size 1 shuffles single samples. Larger values shuffle blocks of consecutive samples, which keeps most reads sequential (e.g. for memory-mapped datasets).
+         * @seed Seed of the random number generator.
+         *
+         * The samples are read through the iterators, only an index vector gets
+         * allocated. Requires iterators that support +=, e.g. random access
+         * iterators. Does not affect <hogwild> and streaming training. Pass
+         * block_size = 0 to use iterator order again.
+         */
+        void shuffle(std::size_t block_size = 1, std::uint64_t seed = 0) {
+            shuffle_block = block_size;
+            shuffle_rng = nntlib::utils::xoshiro256(seed);
+        }
+
     protected:
+        std::size_t batch_size() const {
+            return bsize;
+        }
+
+        T l2() const {
+            return l2_factor;
+        }
+
         template <typename Net, typename InputIt1, typename InputIt2, typename UpdateHook>
         void train_impl(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last, UpdateHook& update_hook) {
             std::size_t n = static_cast<std::size_t>(std::distance(x_first, x_last));
-            auto cache_state = net.allocate_state();
-            auto cache_error = net.allocate_error_storage();
-            auto cache_gradient = net.allocate_delta_storage();
+            auto commit = [&](typename Net::weights_t& gradients_sum, T round_factor){
+                // also use bsize for the last partial batch to avoid over-rating of the remaining samples
+                prepare_and_commit_update(net, gradients_sum, n, round_factor, bsize, update_hook);
+            };
+            train_loop(net, x_first, x_last, y_first, y_last, commit);
+        }
+
+        /* Synchronous training loop.
+         * @commit Called with the gradient sum of every batch and the factor of the current round, must update the net.
+         */
+        template <typename Net, typename InputIt1, typename InputIt2, typename Commit>
+        void train_loop(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last, Commit& commit) {
+            typedef std::integral_constant<bool, is_seekable<InputIt1>::value && is_seekable<InputIt2>::value> seekable_t;
+
+            gradient_runner<Net> runner(net, bsize, threads);
+            auto& workers = runner.workers;
+
+            // sample order of the current round, empty for iterator order
+            std::vector<std::size_t> order;
+            std::vector<std::size_t> blocks;
+            std::size_t n = 0;
+            if (shuffle_block > 0) {
+                if (!seekable_t::value) {
+                    throw std::logic_error("shuffled training requires random access iterators");
+                }
+                n = static_cast<std::size_t>(std::min<std::ptrdiff_t>(std::distance(x_first, x_last), std::distance(y_first, y_last)));
+                order.reserve(n);
+            }
 
             for (std::size_t round = 0; round < rounds; ++round) {
                 T round_factor = ffactor(round);
-                typename Net::weights_t gradients_sum;
-                std::size_t batchcounter = 0;
-                bool first_batch = true;
                 InputIt1 x_iter = x_first;
                 InputIt2 y_iter = y_first;
+                std::size_t pos = 0;
+                if (shuffle_block > 0) {
+                    shuffled_order(order, blocks, n);
+                }
+                auto has_next = [&]{
+                    return (shuffle_block > 0) ? (pos < n) : ((x_iter != x_last) && (y_iter != y_last));
+                };
 
                 // iterate over entire training set
-                while ((x_iter != x_last) && (y_iter != y_last)) {
-                    // calc gradients
-                    auto error_and_gradients = net.backward(
-                        x_iter->begin(), x_iter->end(),
-                        y_iter->begin(), y_iter->end(),
-                        cache_state, cache_error, cache_gradient
-                    );
-                    auto& gradients = error_and_gradients.second;
+                while (has_next()) {
+                    // collect next batch, one column per sample
+                    for (auto& worker : workers) {
+                        worker.n = 0;
+                    }
+                    std::size_t batchcounter = 0;
+                    while ((batchcounter < bsize) && has_next()) {
+                        auto& worker = workers[batchcounter / runner.chunk];
+                        if (shuffle_block > 0) {
+                            InputIt1 x_sample = seek(x_first, order[pos], seekable_t{});
+                            InputIt2 y_sample = seek(y_first, order[pos], seekable_t{});
+                            worker.x_block.assign_col(worker.n, x_sample->begin(), x_sample->end());
+                            worker.y_block.assign_col(worker.n, y_sample->begin(), y_sample->end());
+                            ++pos;
+                        } else {
+                            worker.x_block.assign_col(worker.n, x_iter->begin(), x_iter->end());
+                            worker.y_block.assign_col(worker.n, y_iter->begin(), y_iter->end());
+                            ++x_iter;
+                            ++y_iter;
+                        }
+                        ++worker.n;
+                        ++batchcounter;
+                    }
 
-                    // should we update? (= end of batch)
-                    if (batchcounter == 0) {
-                        // yes => reinit update vector
-                        if (!first_batch) {
-                            prepare_and_commit_update(net, gradients_sum, n, round_factor, bsize, update_hook);
+                    commit(runner.run(net), round_factor);
 
-                            // call batch callback
-                            fbatch();
-                        } else {
-                            first_batch = false;
+                    // call batch callback (not after the last batch of the round)
+                    if (has_next()) {
+                        fbatch();
+                    }
+                }
+
+                // call round callback
+                fround(round);
+            }
+        }
+
+        /* Streaming version of <train_impl>.
+         * @n_samples Number of samples of the stream, the l2 factor gets divided by it. 0 uses the number of samples consumed so far.
+         */
+        template <typename Net, typename Source, typename UpdateHook>
+        void train_stream_impl(Net& net, Source& source, UpdateHook& update_hook, std::size_t n_samples, std::size_t n_prefetch) {
+            std::size_t n_seen = 0;
+            const std::size_t& n = (n_samples > 0) ? n_samples : n_seen;
+            auto commit = [&](typename Net::weights_t& gradients_sum, T round_factor){
+                prepare_and_commit_update(net, gradients_sum, std::max<std::size_t>(1, n), round_factor, bsize, update_hook);
+            };
+            train_stream_loop(net, source, commit, n_prefetch, n_seen);
+        }
+
+        /* Single pass over a stream of batches, see <batch::train_stream>.
+         * @commit Called with the gradient sum of every batch and the factor of the round, must update the net.
+         * @n_seen Gets increased by the number of samples of every batch before its commit.
+         */
+        template <typename Net, typename Source, typename Commit>
+        void train_stream_loop(Net& net, Source& source, Commit& commit, std::size_t n_prefetch, std::size_t& n_seen) {
+            gradient_runner<Net> runner(net, bsize, threads);
+            auto& workers = runner.workers;
+
+            // every slot holds one block per worker, so consuming a slot just swaps blocks
+            typedef stream_block<Net> block_t;
+            std::vector<std::vector<block_t>> slots;
+            for (std::size_t i = 0; i < std::max<std::size_t>(1, n_prefetch); ++i) {
+                std::vector<block_t> slot;
+                for (const auto& worker : workers) {
+                    slot.push_back(block_t{typename Net::batch_input_t(net.size_in(), worker.x_block.cols()), nntlib::storage::row_matrix<T>(net.size_out(), worker.x_block.cols()), 0});
+                }
+                slots.push_back(std::move(slot));
+            }
+            nntlib::concurrency::ring<std::vector<block_t>> queue(std::move(slots));
+
+            std::exception_ptr error;
+            std::thread producer([&]{
+                try {
+                    bool more = true;
+                    while (more) {
+                        std::vector<block_t>* slot = queue.begin_write();
+                        if (slot == nullptr) {
+                            break;
+                        }
+
+                        std::size_t total = 0;
+                        for (auto& block : *slot) {
+                            block.n = more ? source(block.x, block.y) : 0;
+                            more = (block.n == block.x.cols());
+                            total += block.n;
                         }
 
-                        gradients_sum = gradients;
-                    } else {
-                        // no => add gradient to update
-                        nntlib::utils::tuple_join([](auto& lhs, auto& rhs){
-                            nntlib::utils::multi_foreach([](auto& lhs2, auto& rhs2){
-                                nntlib::utils::multi_foreach([](auto& lhs3, auto& rhs3){
-                                    lhs3 += rhs3;
-                                }, lhs2.begin(), lhs2.end(), rhs2.begin(), rhs2.end());
-                            }, lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
-                        }, gradients_sum, gradients);
+                        if (total == 0) {
+                            break;
+                        }
+                        queue.end_write();
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                queue.finish();
+            });
+
+            T round_factor = ffactor(0);
+            bool first = true;
+            try {
+                while (std::vector<block_t>* slot = queue.begin_read()) {
+                    // call batch callback (not before the first batch)
+                    if (!first) {
+                        fbatch();
+                    }
+                    first = false;
+
+                    for (std::size_t w = 0; w < workers.size(); ++w) {
+                        auto& block = (*slot)[w];
+                        std::swap(workers[w].x_block, block.x);
+                        std::swap(workers[w].y_block, block.y);
+                        workers[w].n = block.n;
+                        n_seen += block.n;
                     }
-                    batchcounter = (batchcounter + 1) % bsize;
+                    queue.end_read();
 
-                    ++x_iter;
-                    ++y_iter;
+                    commit(runner.run(net), round_factor);
                 }
+            } catch (...) {
+                queue.close();
+                producer.join();
+                throw;
+            }
+            producer.join();
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+
+            // call round callback
+            fround(0);
+        }
+
+        /* Asynchronous training, see <hogwild>.
+         */
+        template <typename Net, typename InputIt1, typename InputIt2>
+        void train_hogwild_impl(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+            // like the other trainers, stop at the end of the shorter range
+            std::size_t n = static_cast<std::size_t>(std::min<std::ptrdiff_t>(std::distance(x_first, x_last), std::distance(y_first, y_last)));
+            auto hook = [](typename Net::weights_t& _update){};
+
+            // every thread gets its own caches and a contiguous part of the training set
+            nntlib::concurrency::thread_pool pool(threads);
+            std::vector<worker_cache<Net>> workers;
+            workers.reserve(threads);
+            std::vector<InputIt1> x_bounds{x_first};
+            std::vector<InputIt2> y_bounds{y_first};
+            for (std::size_t w = 0; w < threads; ++w) {
+                workers.emplace_back(net, bsize);
+
+                auto range = nntlib::concurrency::split_range(n, threads, w);
+                x_bounds.push_back(std::next(x_bounds.back(), static_cast<std::ptrdiff_t>(range.second - range.first)));
+                y_bounds.push_back(std::next(y_bounds.back(), static_cast<std::ptrdiff_t>(range.second - range.first)));
+            }
+
+            T round_factor = 0.0;
+            auto train_part = [&](std::size_t w){
+                auto& worker = workers[w];
+                InputIt1 x_iter = x_bounds[w];
+                InputIt2 y_iter = y_bounds[w];
 
-                // also commit last partial batch
-                if (!first_batch) {
-                    // also use bsize here to avoid over-rating of the remaining samples
-                    prepare_and_commit_update(net, gradients_sum, n, round_factor, bsize, update_hook);
+                while ((x_iter != x_bounds[w + 1]) && (y_iter != y_bounds[w + 1])) {
+                    worker.n = 0;
+                    while ((worker.n < bsize) && (x_iter != x_bounds[w + 1]) && (y_iter != y_bounds[w + 1])) {
+                        worker.x_block.assign_col(worker.n, x_iter->begin(), x_iter->end());
+                        worker.y_block.assign_col(worker.n, y_iter->begin(), y_iter->end());
+                        ++worker.n;
+
+                        ++x_iter;
+                        ++y_iter;
+                    }
+
+                    net.backward_batch(
+                        worker.x_block, worker.y_block, worker.n,
+                        worker.state, worker.error, worker.gradient
+                    );
+
+                    // no locks here, this races with the other threads (see <hogwild>)
+                    prepare_and_commit_update(net, worker.gradient, n, round_factor, bsize, hook);
+
+                    // only the first thread calls the batch callback
+                    if ((w == 0) && (x_iter != x_bounds[w + 1]) && (y_iter != y_bounds[w + 1])) {
+                        fbatch();
+                    }
                 }
+            };
+
+            for (std::size_t round = 0; round < rounds; ++round) {
+                round_factor = ffactor(round);
+                pool.run(train_part);
 
                 // call round callback
                 fround(round);
@@ -118,35 +553,132 @@ class batch_template {
         std::size_t bsize;
         std::size_t rounds;
         T l2_factor;
+        std::size_t threads;
+        std::size_t shuffle_block;
+        nntlib::utils::xoshiro256 shuffle_rng;
 
-        template <typename Net, typename UpdateHook>
-        void prepare_and_commit_update(Net& net, typename Net::weights_t& gradients_sum, std::size_t n, T round_factor, std::size_t batch_size, UpdateHook& update_hook) {
-            // multiple gradients with learning rate AND mutliply by -1 (opposite direction)
-            nntlib::utils::tuple_apply(gradients_sum, [round_factor, batch_size](auto& w){
-                for (auto& wj : w) {
-                    for (auto& wji : wj) {
-                        wji *= -round_factor / batch_size;
+        template <typename Iter, typename = void>
+        struct is_seekable : std::false_type {};
+
+        template <typename Iter>
+        struct is_seekable<Iter, decltype(std::declval<Iter&>() += 1, void())> : std::true_type {};
+
+        template <typename Iter>
+        static Iter seek(Iter it, std::size_t i, std::true_type _seekable) {
+            it += static_cast<typename std::iterator_traits<Iter>::difference_type>(i);
+            return it;
+        }
+
+        template <typename Iter>
+        static Iter seek(Iter it, std::size_t i, std::false_type _seekable) {
+            std::advance(it, i);
+            return it;
+        }
+
+        /* Generates the sample order of one round, shuffles blocks of shuffle_block consecutive samples.
+         */
+        void shuffled_order(std::vector<std::size_t>& order, std::vector<std::size_t>& blocks, std::size_t n) {
+            blocks.resize((n + shuffle_block - 1) / shuffle_block);
+            std::iota(blocks.begin(), blocks.end(), std::size_t(0));
+            std::shuffle(blocks.begin(), blocks.end(), shuffle_rng);
+
+            order.clear();
+            for (std::size_t b : blocks) {
+                for (std::size_t i = b * shuffle_block; i < std::min(n, (b + 1) * shuffle_block); ++i) {
+                    order.push_back(i);
+                }
+            }
+        }
+
+        /* Block of samples that was produced by a stream source.
+         */
+        template <typename Net>
+        struct stream_block {
+            typename Net::batch_input_t x;
+            nntlib::storage::row_matrix<T> y;
+            std::size_t n;
+        };
+
+        /* Preallocated memory of a single thread.
+         */
+        template <typename Net>
+        struct worker_cache {
+            typename Net::batch_state_t state;
+            typename Net::batch_error_mem_t error;
+            typename Net::weights_t gradient;
+            typename Net::batch_input_t x_block;
+            nntlib::storage::row_matrix<T> y_block;
+            std::size_t n;
+
+            worker_cache(const Net& net, std::size_t batch_size) :
+                state(net.allocate_batch_state(batch_size)),
+                error(net.allocate_batch_error_storage(batch_size)),
+                gradient(net.allocate_delta_storage()),
+                x_block(net.size_in(), batch_size),
+                y_block(net.size_out(), batch_size),
+                n(0) {}
+        };
+
+        /* Workers and threads that calculate the gradient sum of one batch.
+         *
+         * Every worker gets a contiguous part of the batch (chunk samples, the last one might get less).
+         */
+        template <typename Net>
+        struct gradient_runner {
+            std::size_t chunk;
+            nntlib::concurrency::thread_pool pool;
+            std::vector<worker_cache<Net>> workers;
+
+            gradient_runner(const Net& net, std::size_t batch_size, std::size_t n_threads) : chunk((batch_size + std::min(n_threads, batch_size) - 1) / std::min(n_threads, batch_size)), pool((batch_size + chunk - 1) / chunk) {
+                workers.reserve(pool.size());
+                for (std::size_t w = 0; w < pool.size(); ++w) {
+                    workers.emplace_back(net, std::min(chunk, batch_size - w * chunk));
+                }
+            }
+
+            /* Calculates the gradient sum of the samples stored in the workers.
+             * @return Gradient sum, stored within the first worker.
+             */
+            typename Net::weights_t& run(const Net& net) {
+                auto calc_gradients = [&](std::size_t w){
+                    auto& worker = workers[w];
+                    if (worker.n > 0) {
+                        net.backward_batch(
+                            worker.x_block, worker.y_block, worker.n,
+                            worker.state, worker.error, worker.gradient
+                        );
+                    }
+                };
+
+                // every thread sums up one slice of all gradient buffers
+                auto reduce_gradients = [&](std::size_t w){
+                    for (std::size_t k = 1; k < workers.size(); ++k) {
+                        if (workers[k].n > 0) {
+                            nntlib::utils::tuple_join([&](auto& lhs, const auto& rhs){
+                                add_gradient(lhs, rhs, workers.size(), w);
+                            }, workers[0].gradient, workers[k].gradient);
+                        }
                     }
+                };
+
+                pool.run(calc_gradients);
+                if (workers.size() > 1) {
+                    pool.run(reduce_gradients);
                 }
-            });
 
-            // optional l2 regularization
-            if (l2_factor > 0.0) {
-                auto weights = net.get_weights();
-                nntlib::utils::tuple_join([&](auto& lhs, auto& rhs){
-                    nntlib::utils::multi_foreach([&](auto& lhs2, auto& rhs2){
-                        bool first = true;
-                        nntlib::utils::multi_foreach([&](auto& lhs3, auto& rhs3){
-                            // skip first weight (= bias value)
-                            if (first) {
-                                first = false;
-                            } else {
-                                lhs3 -= rhs3 * l2_factor / n;
-                            }
-                        }, lhs2.begin(), lhs2.end(), rhs2.begin(), rhs2.end());
-                    }, lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
-                }, gradients_sum, weights);
+                return workers[0].gradient;
             }
+        };
+
+        template <typename Net, typename UpdateHook>
+        void prepare_and_commit_update(Net& net, typename Net::weights_t& gradients_sum, std::size_t n, T round_factor, std::size_t batch_size, UpdateHook& update_hook) {
+            // multiple gradients with learning rate AND mutliply by -1 (opposite direction), optional l2 regularization
+            T scale = -round_factor / batch_size;
+            T l2 = l2_factor / n;
+            auto weights = net.weights_view();
+            nntlib::utils::tuple_join([scale, l2](auto& lhs, const auto& rhs){
+                scale_and_regularize(lhs, rhs, scale, l2);
+            }, gradients_sum, weights);
 
             // call the update hook
             update_hook(gradients_sum);
@@ -157,6 +689,33 @@ class batch_template {
 };
 }
 
+/* Creates a stream source that reads samples from input iterators, see <batch::train_stream>.
+ * @x_first Begin of the inputs, must yield containers.
+ * @x_last End of the inputs.
+ * @y_first Begin of the outputs, must yield containers.
+ * @y_last End of the outputs.
+ *
+ * The iterators are only incremented, so single pass iterators work as well.
+ * The length of the stream does not have to be known in advance: pass
+ * n_samples = 0 to train_stream and the l2 factor gets divided by the number
+ * of samples consumed so far instead of the total number.
+ */
+template <typename InputIt1, typename InputIt2>
+auto make_source(InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+    return [=](auto& x, auto& y) mutable -> std::size_t {
+        std::size_t n = 0;
+        while ((n < x.cols()) && (x_first != x_last) && (y_first != y_last)) {
+            x.assign_col(n, x_first->begin(), x_first->end());
+            y.assign_col(n, y_first->begin(), y_first->end());
+            ++n;
+
+            ++x_first;
+            ++y_first;
+        }
+        return n;
+    };
+}
+
 template <typename T = double>
 class batch : public _::batch_template<T> {
     public:
@@ -164,13 +723,249 @@ class batch : public _::batch_template<T> {
         typedef typename _::batch_template<T>::func_callback_round_t func_callback_round_t;
         typedef typename _::batch_template<T>::func_callback_batch_t func_callback_batch_t;
 
-        batch(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0) : _::batch_template<T>(func_factor, batch_size, n_rounds, l2) {}
+        batch(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) : _::batch_template<T>(func_factor, batch_size, n_rounds, l2, n_threads) {}
 
         template <typename Net, typename InputIt1, typename InputIt2>
         void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
             auto hook = [](typename Net::weights_t& _update){};
             _::batch_template<T>::train_impl(net, x_first, x_last, y_first, y_last, hook);
         }
+
+        /* Trains with a single pass over a stream of samples, e.g. a file or a generator that does not fit into memory.
+         * @net Net.
+         * @source Function std::size_t(row_matrix<T>& x, row_matrix<T>& y) that stores up to x.cols() samples as columns of x and y (e.g. using assign_col) and returns their number. Returning less than x.cols() ends the stream.
+         * @n_samples (Expected) number of samples of the stream, the l2 factor gets divided by it like in <train>. 0 (default) if unknown, then every update divides it by the number of samples consumed so far (including the current batch).
+         * @n_prefetch Number of batches that get produced in advance.
+         *
+         * The source is called by a background thread, so reading and decoding
+         * overlaps with the gradient calculation. Exceptions of the source are
+         * rethrown after all previously produced batches were trained. The
+         * learning rate of round 0 is used and the round callback gets called
+         * once at the end. See <make_source> for a source that reads input
+         * iterators.
+         */
+        template <typename Net, typename Source>
+        void train_stream(Net& net, Source source, std::size_t n_samples = 0, std::size_t n_prefetch = 4) {
+            auto hook = [](typename Net::weights_t& _update){};
+            _::batch_template<T>::train_stream_impl(net, source, hook, n_samples, n_prefetch);
+        }
+};
+
+/* Asynchronous, lock-free stochastic gradient descent ("Hogwild!").
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * The training set is split into one contiguous part per thread. Every
+ * thread trains on its part using mini-batches and applies its updates to
+ * the shared net without any synchronization. There is no barrier between
+ * threads except at the end of every round.
+ *
+ * Warning: the weights are plain (non-atomic) values that get read and
+ * written by multiple threads at the same time, which is a data race and thus
+ * undefined behaviour in C++ (race detectors will report it). It relies on
+ * the hardware behaviour of mainstream platforms (e.g. x86-64 and AArch64),
+ * where aligned loads and stores of float and double do not tear: concurrent
+ * updates of the same weight might get lost and weights might be read while
+ * other weights of the same row are updated, which SGD tolerates well for
+ * large, overparameterized nets. Atomic accesses would prevent the matrix
+ * products of the passes, so use <batch> with multiple threads if you need
+ * well-defined results.
+ *
+ * The batch callback is only called by the first thread.
+ */
+template <typename T = double>
+class hogwild : public _::batch_template<T> {
+    public:
+        typedef typename _::batch_template<T>::func_factor_t func_factor_t;
+        typedef typename _::batch_template<T>::func_callback_round_t func_callback_round_t;
+        typedef typename _::batch_template<T>::func_callback_batch_t func_callback_batch_t;
+
+        /* Creates new trainer.
+         * @func_factor Learning rate depending on the round.
+         * @batch_size Number of samples per update.
+         * @n_rounds Number of rounds over the entire training set.
+         * @l2 L2 regularization factor.
+         * @n_threads Number of threads, every thread trains on its own part of the training set.
+         */
+        hogwild(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) : _::batch_template<T>(func_factor, batch_size, n_rounds, l2, n_threads) {}
+
+        template <typename Net, typename InputIt1, typename InputIt2>
+        void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+            _::batch_template<T>::train_hogwild_impl(net, x_first, x_last, y_first, y_last);
+        }
+};
+
+/* Stochastic gradient descent with momentum.
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * The velocity has the same layout as the weights. Scaling, l2 term, velocity
+ * update and weight update happen in a single pass over memory. The velocity
+ * starts at zero for every call of <train>. Sparse gradients (see
+ * <nntlib::layer::sparse_input>) only update the touched rows, including their
+ * velocity.
+ */
+template <typename T = double>
+class momentum : public _::batch_template<T> {
+    public:
+        typedef typename _::batch_template<T>::func_factor_t func_factor_t;
+        typedef typename _::batch_template<T>::func_callback_round_t func_callback_round_t;
+        typedef typename _::batch_template<T>::func_callback_batch_t func_callback_batch_t;
+
+        /* Creates new trainer.
+         * @mu Momentum, e.g. 0.9.
+         * @func_factor Learning rate depending on the round.
+         * @batch_size Number of samples per update.
+         * @n_rounds Number of rounds over the entire training set.
+         * @l2 L2 regularization factor.
+         * @n_threads Number of threads that calculate gradients in parallel.
+         */
+        momentum(T mu, func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) : _::batch_template<T>(func_factor, batch_size, n_rounds, l2, n_threads), mu_factor(mu), use_nesterov(false) {}
+
+        template <typename Net, typename InputIt1, typename InputIt2>
+        void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+            const std::size_t n = static_cast<std::size_t>(std::distance(x_first, x_last));
+            auto commit = make_commit(net, n);
+            _::batch_template<T>::train_loop(net, x_first, x_last, y_first, y_last, commit);
+        }
+
+        /* Trains with a single pass over a stream of samples, see <batch::train_stream>.
+         */
+        template <typename Net, typename Source>
+        void train_stream(Net& net, Source source, std::size_t n_samples = 0, std::size_t n_prefetch = 4) {
+            std::size_t n_seen = 0;
+            auto commit = make_commit(net, (n_samples > 0) ? n_samples : n_seen);
+            _::batch_template<T>::train_stream_loop(net, source, commit, n_prefetch, n_seen);
+        }
+
+    protected:
+        T mu_factor;
+        bool use_nesterov;
+
+    private:
+        /* @n_samples The l2 factor gets divided by it, read at every update (so it may grow while streaming).
+         */
+        template <typename Net>
+        auto make_commit(Net& net, const std::size_t& n_samples) {
+            T l2_factor = this->l2();
+            T mu = mu_factor;
+            bool nesterov = use_nesterov;
+            std::size_t batch_size = this->batch_size();
+            return [&net, &n_samples, l2_factor, mu, nesterov, batch_size, velocity = net.allocate_delta_storage()](typename Net::weights_t& gradients_sum, T round_factor) mutable {
+                T scale = -round_factor / batch_size;
+                T l2 = l2_factor / static_cast<T>(std::max<std::size_t>(1, n_samples));
+                auto step = [=](auto& w, const auto& g, auto& v){
+                    _::momentum_step(g, w, v, scale, l2, mu, nesterov);
+                };
+                net.apply_update(step, gradients_sum, velocity);
+            };
+        }
+};
+
+/* Stochastic gradient descent with Nesterov momentum, see <momentum>.
+ * @T Floating point type which is used for the entire neural network.
+ */
+template <typename T = double>
+class nesterov : public momentum<T> {
+    public:
+        typedef typename momentum<T>::func_factor_t func_factor_t;
+
+        nesterov(T mu, func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) : momentum<T>(mu, func_factor, batch_size, n_rounds, l2, n_threads) {
+            this->use_nesterov = true;
+        }
+};
+
+/* Adam optimizer (Kingma and Ba).
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * The learning rate function sets the step size. Both moments have the same
+ * layout as the weights. Scaling, l2 term, moment updates and weight update
+ * happen in a single pass over memory. The moments start at zero for every
+ * call of <train>. The l2 term gets added to the gradient, see <adamw> for
+ * decoupled weight decay. Sparse gradients (see <nntlib::layer::sparse_input>)
+ * only update the touched rows, including their moments.
+ */
+template <typename T = double>
+class adam : public _::batch_template<T> {
+    public:
+        typedef typename _::batch_template<T>::func_factor_t func_factor_t;
+        typedef typename _::batch_template<T>::func_callback_round_t func_callback_round_t;
+        typedef typename _::batch_template<T>::func_callback_batch_t func_callback_batch_t;
+
+        /* Creates new trainer.
+         * @func_factor Learning rate depending on the round, e.g. 1e-3.
+         * @batch_size Number of samples per update.
+         * @n_rounds Number of rounds over the entire training set.
+         * @l2 L2 regularization factor.
+         * @n_threads Number of threads that calculate gradients in parallel.
+         * @beta1 Decay of the first moment.
+         * @beta2 Decay of the second moment.
+         * @eps Term that avoids divisions by zero.
+         */
+        adam(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1, T beta1 = 0.9, T beta2 = 0.999, T eps = 1e-8) : _::batch_template<T>(func_factor, batch_size, n_rounds, l2, n_threads), b1(beta1), b2(beta2), epsilon(eps), decoupled(false) {}
+
+        template <typename Net, typename InputIt1, typename InputIt2>
+        void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+            const std::size_t n = static_cast<std::size_t>(std::distance(x_first, x_last));
+            auto commit = make_commit(net, n);
+            _::batch_template<T>::train_loop(net, x_first, x_last, y_first, y_last, commit);
+        }
+
+        /* Trains with a single pass over a stream of samples, see <batch::train_stream>.
+         */
+        template <typename Net, typename Source>
+        void train_stream(Net& net, Source source, std::size_t n_samples = 0, std::size_t n_prefetch = 4) {
+            std::size_t n_seen = 0;
+            auto commit = make_commit(net, (n_samples > 0) ? n_samples : n_seen);
+            _::batch_template<T>::train_stream_loop(net, source, commit, n_prefetch, n_seen);
+        }
+
+    protected:
+        T b1;
+        T b2;
+        T epsilon;
+        bool decoupled;
+
+    private:
+        /* @n_samples The coupled l2 factor gets divided by it, read at every update (so it may grow while streaming).
+         */
+        template <typename Net>
+        auto make_commit(Net& net, const std::size_t& n_samples) {
+            T l2_factor = decoupled ? T(0) : this->l2();
+            T l2_decoupled = decoupled ? this->l2() : T(0);
+            T scale = T(1) / this->batch_size();
+            T beta1 = b1;
+            T beta2 = b2;
+            T eps = epsilon;
+            T beta1_t = 1.0;
+            T beta2_t = 1.0;
+            return [&net, &n_samples, l2_factor, l2_decoupled, scale, beta1, beta2, eps, beta1_t, beta2_t, m = net.allocate_delta_storage(), v = net.allocate_delta_storage()](typename Net::weights_t& gradients_sum, T round_factor) mutable {
+                T l2_coupled = l2_factor / static_cast<T>(std::max<std::size_t>(1, n_samples));
+                beta1_t *= beta1;
+                beta2_t *= beta2;
+                T c1 = T(1) / (T(1) - beta1_t);
+                T c2 = T(1) / (T(1) - beta2_t);
+                auto step = [=](auto& w, const auto& g, auto& mi, auto& vi){
+                    _::adam_step(g, w, mi, vi, round_factor, scale, l2_coupled, l2_decoupled, beta1, beta2, c1, c2, eps);
+                };
+                net.apply_update(step, gradients_sum, m, v);
+            };
+        }
+};
+
+/* Adam with decoupled weight decay (Loshchilov and Hutter), see <adam>.
+ * @T Floating point type which is used for the entire neural network.
+ *
+ * The l2 factor is used as weight decay and applied to the weights directly
+ * (w -= lr * l2 * w every step) instead of being added to the gradient. Unlike
+ * the coupled l2 term, it does not get divided by the number of samples.
+ */
+template <typename T = double>
+class adamw : public adam<T> {
+    public:
+        typedef typename adam<T>::func_factor_t func_factor_t;
+
+        adamw(func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1, T beta1 = 0.9, T beta2 = 0.999, T eps = 1e-8) : adam<T>(func_factor, batch_size, n_rounds, l2, n_threads, beta1, beta2, eps) {
+            this->decoupled = true;
+        }
 };
 
 template <typename T = double>
@@ -180,8 +975,8 @@ class lbfgs : public _::batch_template<T> {
         typedef typename _::batch_template<T>::func_callback_round_t func_callback_round_t;
         typedef typename _::batch_template<T>::func_callback_batch_t func_callback_batch_t;
 
-        lbfgs(std::size_t history_size, func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0) :
-                _::batch_template<T>([](std::size_t _i){return 1.0;}, batch_size, n_rounds, l2),
+        lbfgs(std::size_t history_size, func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0, std::size_t n_threads = 1) :
+                _::batch_template<T>([](std::size_t _i){return 1.0;}, batch_size, n_rounds, l2, n_threads),
                 ffactor(func_factor), fround([](std::size_t _i){}),
                 histsize(history_size) {
             _::batch_template<T>::callback_round([&](std::size_t round){
@@ -197,46 +992,59 @@ class lbfgs : public _::batch_template<T> {
         template <typename Net, typename InputIt1, typename InputIt2>
         void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
             nround = 0;
-            matrix_t update_last;
-            matrix_t weights_last;
+            vector_t update_last;
+            vector_t weights_last;
+            vector_t update_current;
+            vector_t weights_current;
+            vector_t q;
             bool first = true;
             std::list<history_entry> history;
+            std::list<history_entry> spare;
+            std::vector<T> alpha;
 
             auto hook = [&](typename Net::weights_t& update){
-                auto update_current = update2vector<typename Net::weights_t>(update, -1.0);
-                auto weights_current = update2vector<typename Net::weights_t>(net.get_weights(), 1.0);
+                update2vector<typename Net::weights_t>(update, -1.0, update_current);
+                update2vector(net.weights_view(), 1.0, weights_current);
 
                 if (first) {
                     first = false;
-                } else {
+                } else if (spare.empty()) {
                     history.emplace_back(weights_current - weights_last, update_current - update_last);
+                } else {
+                    // reuse the node and the vectors of a dropped entry
+                    history.splice(history.end(), spare, spare.begin());
+                    history.back().assign(weights_current - weights_last, update_current - update_last);
                 }
 
-                auto id = matrix_t::Identity(update_current.rows(), update_current.rows());
-                matrix_t bk = id;
+                // two-loop recursion, calculates H * gradient without building H
+                q = update_current;
+                alpha.resize(history.size());
+                std::size_t i = history.size();
+                for (auto it = history.rbegin(); it != history.rend(); ++it) {
+                    --i;
+                    alpha[i] = it->rho * it->sk.dot(q);
+                    q -= alpha[i] * it->yk;
+                }
                 for (const auto& entry : history) {
-                    T norm = (entry.yk.transpose() * entry.sk)(0, 0);
-
-                    bk = (id - (entry.sk * entry.yk.transpose()) / norm)
-                        *  bk
-                        * (id - (entry.yk * entry.sk.transpose()) / norm)
-                        + (entry.sk * entry.sk.transpose()) / norm;
+                    T beta = entry.rho * entry.yk.dot(q);
+                    q += (alpha[i] - beta) * entry.sk;
+                    ++i;
                 }
 
-                vector2update<typename Net::weights_t>(update, bk * update_current);
+                vector2update<typename Net::weights_t>(update, q);
 
                 while (history.size() > histsize) {
-                    history.pop_front();
+                    spare.splice(spare.end(), history, history.begin());
                 }
 
-                update_last = std::move(update_current);
-                weights_last = std::move(weights_current);
+                std::swap(update_last, update_current);
+                std::swap(weights_last, weights_current);
             };
             _::batch_template<T>::train_impl(net, x_first, x_last, y_first, y_last, hook);
         }
 
     private:
-        typedef typename Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+        typedef typename Eigen::Matrix<T, Eigen::Dynamic, 1> vector_t;
 
         func_factor_t ffactor;
         func_callback_round_t fround;
@@ -244,41 +1052,56 @@ class lbfgs : public _::batch_template<T> {
         std::size_t nround;
 
         template <typename Weights>
-        matrix_t update2vector(const Weights& weights, T factor) {
-            std::vector<T> vector;
+        void update2vector(const Weights& weights, T factor, vector_t& result) {
+            std::size_t n = 0;
+            nntlib::utils::tuple_apply(weights, [&](const auto& part){
+                for (const auto& x : part) {
+                    n += x.size();
+                }
+            });
+            result.resize(n);
+
+            std::size_t pos = 0;
             nntlib::utils::tuple_apply(weights, [&](const auto& part){
                 for (const auto& x : part) {
                     for (T y : x) {
-                        vector.push_back(y * factor);
+                        result(pos++) = y * factor;
                     }
                 }
             });
-            matrix_t result(vector.size(), 1);
-            for (std::size_t i = 0; i < vector.size(); ++i) {
-                result(i, 0) = vector[i];
-            }
-            return result;
         }
 
         template <typename Weights>
-        Weights vector2update(Weights& update, const matrix_t& vector) {
+        void vector2update(Weights& update, const vector_t& vector) {
             std::size_t pos = 0;
             T factor = -ffactor(nround);
             nntlib::utils::tuple_apply(update, [&](auto& part){
                 for (auto& x : part) {
                     for (T& y : x) {
-                        y = vector(pos++, 0) * factor;
+                        y = vector(pos++) * factor;
                     }
                 }
+                _::touch_all(part);
             });
-            return update;
         }
 
         struct history_entry {
-            matrix_t sk;
-            matrix_t yk;
+            vector_t sk;
+            vector_t yk;
+            T rho;
 
-            history_entry(matrix_t&& sk_move, matrix_t&& yk_move) : sk(std::move(sk_move)), yk(std::move(yk_move)) {}
+            history_entry(vector_t&& sk_move, vector_t&& yk_move) : sk(std::move(sk_move)), yk(std::move(yk_move)) {
+                rho = 1.0 / yk.dot(sk);
+            }
+
+            /* Overwrites the entry, does not allocate if the sizes match.
+             */
+            template <typename Sk, typename Yk>
+            void assign(const Sk& sk_new, const Yk& yk_new) {
+                sk = sk_new;
+                yk = yk_new;
+                rho = 1.0 / yk.dot(sk);
+            }
         };
 };
 
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <iterator>
 #include <tuple>
+#include <type_traits>
 
 
 namespace nntlib {
@@ -102,6 +104,14 @@ struct multi_foreach_impl_incr<LastCurrent, LastEnd> {
     }
 };
 
+template <typename Layer>
+auto refresh_layer_impl(Layer& layer, int) -> decltype(layer.refresh()) {
+    return layer.refresh();
+}
+
+template <typename Layer>
+void refresh_layer_impl(Layer& _layer, long) {/* noop */}
+
 }
 
 /* Placeholder for implementation defined types.
@@ -121,6 +131,78 @@ struct head_tail {
     typedef head_tail<Tail...> tail;
 };
 
+/* Calls refresh() of a layer, if it has one (e.g. to rebuild data that is derived from its weights).
+ * @layer Layer.
+ */
+template <typename Layer>
+void refresh_layer(Layer& layer) {
+    _::refresh_layer_impl(layer, 0);
+}
+
+/* Checks if all template arguments are the same type.
+ */
+template <typename... Ts>
+struct all_same : std::true_type {};
+
+template <typename Head, typename... Tail>
+struct all_same<Head, Head, Tail...> : all_same<Head, Tail...> {};
+
+template <typename Head, typename Next, typename... Tail>
+struct all_same<Head, Next, Tail...> : std::false_type {};
+
+/* xoshiro256** pseudo random number generator by Blackman and Vigna.
+ *
+ * Returns 64 random bits per call and is much faster than std::mt19937 while
+ * having a small state. Satisfies the UniformRandomBitGenerator concept, so it
+ * can be used with the distributions of <random>.
+ */
+class xoshiro256 {
+    public:
+        typedef std::uint64_t result_type;
+
+        /* Creates new generator.
+         * @seed Seed, gets expanded to the full state using splitmix64.
+         */
+        explicit xoshiro256(std::uint64_t seed = 0x9e3779b97f4a7c15ull) {
+            for (auto& si : s) {
+                seed += 0x9e3779b97f4a7c15ull;
+                std::uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                si = z ^ (z >> 31);
+            }
+        }
+
+        static constexpr result_type min() {
+            return 0;
+        }
+
+        static constexpr result_type max() {
+            return ~result_type(0);
+        }
+
+        result_type operator()() {
+            const std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+            const std::uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+    private:
+        std::uint64_t s[4];
+
+        static std::uint64_t rotl(std::uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+};
+
 /* Applies function to all tuple elements.
  * @Tuple Tuple type, must be of form std::tuple<...>.
  * @Function Function that is applied to the elements of a tuple, can be a template.
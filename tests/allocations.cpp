@@ -0,0 +1,329 @@
+#include "../bench/bench.hpp"
+
+#include <nntlib/nntlib.hpp>
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Checks that training does not allocate in its steady state. Every
+ * combination of layer setup and trainer gets trained for N and for N + k
+ * rounds (streamed trainers get N and N + k times the samples) and both runs
+ * have to allocate exactly the same number of times, i.e. only during setup.
+ * N rounds are enough to fill all buffers that grow during the first batches
+ * (e.g. the L-BFGS history and the blocks of the stream ring). Counts malloc
+ * calls, which includes operator new and Eigen, see bench.hpp.
+ *
+ * Usage: allocations
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+typedef std::vector<std::vector<std::pair<std::size_t, T>>> sparse_set;
+
+constexpr std::size_t n_inputs = 6;
+constexpr std::size_t n_hidden = 8;
+constexpr std::size_t n_samples = 48;
+constexpr std::size_t batch_size = 16;
+constexpr std::size_t n_threads = 2;
+constexpr std::size_t n_rounds = 2;
+constexpr std::size_t n_extra = 3;
+constexpr T l2 = 1e-3;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> hidden_t;
+typedef nntlib::layer::fully_connected<nntlib::activation::identity<T>, T> output_t;
+
+dense_set dense_inputs(std::size_t n) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n, std::vector<T>(n_inputs));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    return x;
+}
+
+sparse_set sparse_inputs(std::size_t n) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    sparse_set x(n);
+    for (auto& xi : x) {
+        xi.emplace_back(rng() % n_inputs, dist(rng));
+        xi.emplace_back(rng() % n_inputs, dist(rng));
+    }
+    return x;
+}
+
+/* One-hot targets, so they work for softmax heads as well.
+ */
+dense_set targets(std::size_t n, std::size_t n_out) {
+    dense_set y(n, std::vector<T>(n_out, 0.0));
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i][i % n_out] = 1.0;
+    }
+    return y;
+}
+
+/* Layer setups, every setup owns its layers and the net that refers to them.
+ */
+struct setup_tanh {
+    static constexpr std::size_t n_out = 1;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, hidden_t, output_t> net{l1, l2};
+};
+
+struct setup_softmax {
+    typedef nntlib::layer::fully_connected<nntlib::activation::softmax<T>, T> head_t;
+    static constexpr std::size_t n_out = 3;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    head_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::cross_entropy<T>, hidden_t, head_t> net{l1, l2};
+};
+
+struct setup_softmax_ce {
+    typedef nntlib::layer::fully_connected<nntlib::activation::softmax_cross_entropy<T>, T> head_t;
+    static constexpr std::size_t n_out = 3;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    head_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::softmax_cross_entropy<T>, hidden_t, head_t> net{l1, l2};
+};
+
+struct setup_sparse_input {
+    typedef nntlib::layer::sparse_input<nntlib::activation::tanh<T>, T> input_t;
+    static constexpr std::size_t n_out = 1;
+    static sparse_set inputs(std::size_t n) {
+        return sparse_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    input_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, input_t, output_t> net{l1, l2};
+};
+
+struct setup_fixed {
+    typedef nntlib::layer::fully_connected_fixed<nntlib::activation::tanh<T>, n_inputs, n_hidden, T> fixed_t;
+    static constexpr std::size_t n_out = 1;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    fixed_t l1{rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, fixed_t, output_t> net{l1, l2};
+};
+
+struct setup_mixed {
+    typedef nntlib::layer::fully_connected_mixed<nntlib::activation::tanh<T>, float, T> mixed_t;
+    static constexpr std::size_t n_out = 1;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    mixed_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, mixed_t, output_t> net{l1, l2};
+};
+
+struct setup_dropout {
+    typedef nntlib::layer::dropout<T> dropout_t;
+    static constexpr std::size_t n_out = 1;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    dropout_t l1{n_inputs, 0.2, rng};
+    hidden_t l2{n_inputs, n_hidden, rng};
+    output_t l3{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, dropout_t, hidden_t, output_t> net{l1, l2, l3};
+};
+
+struct setup_pruned {
+    typedef nntlib::layer::pruned<hidden_t> pruned_t;
+    static constexpr std::size_t n_out = 1;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t trained{n_inputs, n_hidden, rng};
+    pruned_t l1{trained, 0.5};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, pruned_t, output_t> net{l1, l2};
+};
+
+std::size_t failures = 0;
+
+/* Counts the allocations of a function call.
+ */
+template <typename Function>
+std::size_t count(Function func) {
+    std::size_t before = bench::allocations();
+    func();
+    return bench::allocations() - before;
+}
+
+/* Compares the allocations of N and N + k rounds.
+ * @name Name of the check.
+ * @run Function std::size_t(std::size_t rounds) that returns the number of allocations of a training run.
+ */
+template <typename Run>
+void check(const std::string& name, Run run) {
+    // warm up, e.g. lazily initialized state of the runtime
+    run(n_rounds);
+
+    std::size_t a = run(n_rounds);
+    std::size_t b = run(n_rounds + n_extra);
+    if (a == b) {
+        std::cout << "ok    " << name << " (" << a << " allocations)" << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << name << ": " << a << " allocations for " << n_rounds << " rounds, " << b << " for " << n_rounds + n_extra << " rounds" << std::endl;
+    }
+}
+
+template <typename Setup>
+void check_trainers(const std::string& name) {
+    auto x = Setup::inputs(n_samples);
+    auto y = targets(n_samples, Setup::n_out);
+    auto lr = [](std::size_t _round){return 0.01;};
+
+    // streamed trainers see the training set once per "round"
+    decltype(x) xs;
+    dense_set ys;
+    for (std::size_t round = 0; round < n_rounds + n_extra; ++round) {
+        xs.insert(xs.end(), x.begin(), x.end());
+        ys.insert(ys.end(), y.begin(), y.end());
+    }
+
+    auto train = [&](auto& trainer, std::size_t _rounds){
+        Setup s;
+        return count([&]{
+            trainer.train(s.net, x.begin(), x.end(), y.begin(), y.end());
+        });
+    };
+    // unsized streams (n_samples = 0) normalize l2 by the samples consumed so far
+    auto train_stream = [&](auto& trainer, std::size_t rounds, bool sized){
+        Setup s;
+        std::size_t n = rounds * n_samples;
+        auto source = nntlib::training::make_source(xs.begin(), xs.begin() + n, ys.begin(), ys.begin() + n);
+        return count([&]{
+            trainer.train_stream(s.net, source, sized ? n : 0);
+        });
+    };
+
+    check(name + " batch", [&](std::size_t rounds){
+        nntlib::training::batch<T> trainer(lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " batch shuffled", [&](std::size_t rounds){
+        nntlib::training::batch<T> trainer(lr, batch_size, rounds, l2, n_threads);
+        trainer.shuffle(4, 7);
+        return train(trainer, rounds);
+    });
+    check(name + " hogwild", [&](std::size_t rounds){
+        nntlib::training::hogwild<T> trainer(lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " momentum", [&](std::size_t rounds){
+        nntlib::training::momentum<T> trainer(0.9, lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " nesterov", [&](std::size_t rounds){
+        nntlib::training::nesterov<T> trainer(0.9, lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " adam", [&](std::size_t rounds){
+        nntlib::training::adam<T> trainer(lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " adamw", [&](std::size_t rounds){
+        nntlib::training::adamw<T> trainer(lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " lbfgs", [&](std::size_t rounds){
+        nntlib::training::lbfgs<T> trainer(3, lr, batch_size, rounds, l2, n_threads);
+        return train(trainer, rounds);
+    });
+    check(name + " batch stream", [&](std::size_t rounds){
+        nntlib::training::batch<T> trainer(lr, batch_size, 1, l2, n_threads);
+        return train_stream(trainer, rounds, true);
+    });
+    check(name + " momentum stream", [&](std::size_t rounds){
+        nntlib::training::momentum<T> trainer(0.9, lr, batch_size, 1, l2, n_threads);
+        return train_stream(trainer, rounds, true);
+    });
+    check(name + " adam stream", [&](std::size_t rounds){
+        nntlib::training::adam<T> trainer(lr, batch_size, 1, l2, n_threads);
+        return train_stream(trainer, rounds, true);
+    });
+    check(name + " batch stream unsized", [&](std::size_t rounds){
+        nntlib::training::batch<T> trainer(lr, batch_size, 1, l2, n_threads);
+        return train_stream(trainer, rounds, false);
+    });
+    check(name + " momentum stream unsized", [&](std::size_t rounds){
+        nntlib::training::momentum<T> trainer(0.9, lr, batch_size, 1, l2, n_threads);
+        return train_stream(trainer, rounds, false);
+    });
+}
+
+/* Without NNTLIB_INSTRUMENTATION a net only holds references to its layers and does not allocate.
+ */
+void check_net() {
+    typedef nntlib::net<T, nntlib::loss::mse<T>, hidden_t, output_t> net_t;
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, 1, rng};
+    std::size_t a = count([&]{
+        net_t net(l1, l2);
+        net_t copy = net;
+    });
+    if ((a == 0) && (sizeof(net_t) == 2 * sizeof(void*))) {
+        std::cout << "ok    net construction (0 allocations, " << sizeof(net_t) << " bytes)" << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  net construction: " << a << " allocations, " << sizeof(net_t) << " bytes" << std::endl;
+    }
+}
+
+int main() {
+    check_net();
+    check_trainers<setup_tanh>("tanh");
+    check_trainers<setup_softmax>("softmax");
+    check_trainers<setup_softmax_ce>("softmax_ce");
+    check_trainers<setup_sparse_input>("sparse_input");
+    check_trainers<setup_fixed>("fixed");
+    check_trainers<setup_mixed>("mixed");
+    check_trainers<setup_dropout>("dropout");
+    check_trainers<setup_pruned>("pruned");
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
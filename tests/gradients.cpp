@@ -0,0 +1,214 @@
+#include <nntlib/nntlib.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Checks that the batched passes (forward_batch/backward_batch) produce the
+ * same outputs and gradients as the per-sample passes, summed over the
+ * samples of the batch. Covers every layer type that has its own batch
+ * implementation and batch sizes of 1 and 7.
+ *
+ * Usage: gradients
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+typedef std::vector<std::vector<std::pair<std::size_t, T>>> sparse_set;
+
+constexpr std::size_t n_inputs = 6;
+constexpr std::size_t n_hidden = 5;
+constexpr T tolerance = 1e-12;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> hidden_t;
+typedef nntlib::layer::fully_connected<nntlib::activation::identity<T>, T> output_t;
+
+dense_set dense_inputs(std::size_t n) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n, std::vector<T>(n_inputs));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    return x;
+}
+
+sparse_set sparse_inputs(std::size_t n) {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    sparse_set x(n);
+    for (auto& xi : x) {
+        xi.emplace_back(rng() % n_inputs, dist(rng));
+        xi.emplace_back(rng() % n_inputs, dist(rng));
+    }
+    return x;
+}
+
+/* One-hot targets, so they work for softmax heads as well.
+ */
+dense_set targets(std::size_t n, std::size_t n_out) {
+    dense_set y(n, std::vector<T>(n_out, 0.0));
+    for (std::size_t i = 0; i < n; ++i) {
+        y[i][i % n_out] = 1.0;
+    }
+    return y;
+}
+
+/* Layer setups, every setup owns its layers and the net that refers to them.
+ */
+struct setup_dense {
+    static constexpr std::size_t n_out = 2;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, hidden_t, output_t> net{l1, l2};
+};
+
+struct setup_softmax_ce {
+    typedef nntlib::layer::fully_connected<nntlib::activation::softmax_cross_entropy<T>, T> head_t;
+    static constexpr std::size_t n_out = 3;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    hidden_t l1{n_inputs, n_hidden, rng};
+    head_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::softmax_cross_entropy<T>, hidden_t, head_t> net{l1, l2};
+};
+
+struct setup_fixed {
+    typedef nntlib::layer::fully_connected_fixed<nntlib::activation::tanh<T>, n_inputs, n_hidden, T> fixed_t;
+    static constexpr std::size_t n_out = 2;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    fixed_t l1{rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, fixed_t, output_t> net{l1, l2};
+};
+
+struct setup_mixed {
+    typedef nntlib::layer::fully_connected_mixed<nntlib::activation::tanh<T>, nntlib::storage::bfloat16, T> mixed_t;
+    static constexpr std::size_t n_out = 2;
+    static dense_set inputs(std::size_t n) {
+        return dense_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    mixed_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, mixed_t, output_t> net{l1, l2};
+};
+
+struct setup_sparse_input {
+    typedef nntlib::layer::sparse_input<nntlib::activation::tanh<T>, T> input_t;
+    static constexpr std::size_t n_out = 2;
+    static sparse_set inputs(std::size_t n) {
+        return sparse_inputs(n);
+    }
+
+    std::mt19937 rng{1};
+    input_t l1{n_inputs, n_hidden, rng};
+    output_t l2{n_hidden, n_out, rng};
+    nntlib::net<T, nntlib::loss::mse<T>, input_t, output_t> net{l1, l2};
+};
+
+std::size_t failures = 0;
+
+/* Maximum absolute difference of two matrices with the same layout.
+ */
+template <typename Matrix>
+T max_diff(const Matrix& a, const Matrix& b) {
+    T result = 0.0;
+    for (std::size_t i = 0; i < a.buffer_size(); ++i) {
+        result = std::max(result, std::abs(a.data()[i] - b.data()[i]));
+    }
+    return result;
+}
+
+template <typename Setup>
+void check_setup(const std::string& name, std::size_t n) {
+    Setup s;
+    auto& net = s.net;
+    auto x = Setup::inputs(n);
+    auto y = targets(n, Setup::n_out);
+
+    // batched passes
+    typename std::decay_t<decltype(net)>::batch_input_t x_block(net.size_in(), n);
+    nntlib::storage::row_matrix<T> y_block(net.size_out(), n);
+    for (std::size_t b = 0; b < n; ++b) {
+        x_block.assign_col(b, x[b].begin(), x[b].end());
+        y_block.assign_col(b, y[b].begin(), y[b].end());
+    }
+    auto state_batch = net.allocate_batch_state(n);
+    auto error_batch = net.allocate_batch_error_storage(n);
+    auto gradient_batch = net.allocate_delta_storage();
+    net.backward_batch(x_block, y_block, n, state_batch, error_batch, gradient_batch);
+    nntlib::storage::row_matrix<T> out_batch = net.forward_batch(x_block, n, state_batch);
+
+    // per-sample passes, summed up
+    auto state = net.allocate_state();
+    auto error = net.allocate_error_storage();
+    auto gradient = net.allocate_delta_storage();
+    auto gradient_sum = net.allocate_delta_storage();
+    T out_diff = 0.0;
+    for (std::size_t b = 0; b < n; ++b) {
+        net.backward(x[b].begin(), x[b].end(), y[b].begin(), y[b].end(), state, error, gradient);
+        nntlib::utils::tuple_join([](auto& lhs, const auto& rhs){
+            for (std::size_t i = 0; i < lhs.buffer_size(); ++i) {
+                lhs.data()[i] += rhs.data()[i];
+            }
+        }, gradient_sum, gradient);
+
+        const auto& out = net.forward(x[b].begin(), x[b].end(), state);
+        for (std::size_t j = 0; j < out.size(); ++j) {
+            out_diff = std::max(out_diff, std::abs(out[j] - out_batch(j, b)));
+        }
+    }
+
+    T gradient_diff = 0.0;
+    nntlib::utils::tuple_join([&](const auto& lhs, const auto& rhs){
+        gradient_diff = std::max(gradient_diff, max_diff(lhs, rhs));
+    }, gradient_sum, gradient_batch);
+
+    std::string check = name + " n=" + std::to_string(n);
+    if ((out_diff <= tolerance) && (gradient_diff <= tolerance)) {
+        std::cout << "ok    " << check << " (output " << out_diff << ", gradient " << gradient_diff << ")" << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << check << ": output differs by " << out_diff << ", gradient by " << gradient_diff << std::endl;
+    }
+}
+
+template <typename Setup>
+void check_batch_sizes(const std::string& name) {
+    check_setup<Setup>(name, 1);
+    check_setup<Setup>(name, 7);
+}
+
+int main() {
+    check_batch_sizes<setup_dense>("dense");
+    check_batch_sizes<setup_softmax_ce>("softmax_ce");
+    check_batch_sizes<setup_fixed>("fixed");
+    check_batch_sizes<setup_mixed>("mixed");
+    check_batch_sizes<setup_sparse_input>("sparse_input");
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#define NNTLIB_INSTRUMENTATION
+
+#include <nntlib/nntlib.hpp>
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Checks the per-layer counters of the instrumented build: every layer of a
+ * trained net records calls, FLOPs and samples, nets do not share their
+ * counters (but copies do) and reset clears them.
+ *
+ * Usage: instrumentation
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+
+constexpr std::size_t n_inputs = 6;
+constexpr std::size_t n_hidden = 8;
+constexpr std::size_t n_samples = 32;
+constexpr std::size_t batch_size = 8;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> hidden_t;
+typedef nntlib::layer::fully_connected<nntlib::activation::identity<T>, T> output_t;
+typedef nntlib::net<T, nntlib::loss::mse<T>, hidden_t, output_t> net_t;
+
+std::size_t failures = 0;
+
+void check(const std::string& name, bool ok) {
+    if (ok) {
+        std::cout << "ok    " << name << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << name << std::endl;
+    }
+}
+
+dense_set random_set(std::size_t n, std::size_t dim, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n, std::vector<T>(dim));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    return x;
+}
+
+int main() {
+    static_assert(nntlib::instrumentation::enabled, "instrumentation must be enabled");
+
+    auto x = random_set(n_samples, n_inputs, 2);
+    auto y = random_set(n_samples, 1, 3);
+
+    std::mt19937 rng(1);
+    hidden_t a1(n_inputs, n_hidden, rng);
+    output_t a2(n_hidden, 1, rng);
+    net_t a(a1, a2);
+    hidden_t b1(n_inputs, n_hidden, rng);
+    output_t b2(n_hidden, 1, rng);
+    net_t b(b1, b2);
+
+    nntlib::training::batch<T> trainer([](std::size_t _round){return 0.01;}, batch_size, 2);
+    trainer.train(a, x.begin(), x.end(), y.begin(), y.end());
+
+    auto stats = a.instrumentation().snapshot();
+    check("one entry per layer", stats.size() == 2);
+    for (std::size_t i = 0; i < stats.size(); ++i) {
+        const auto& s = stats[i];
+        std::string layer = "layer " + std::to_string(i);
+        check(layer + " name", s.name != nullptr);
+        check(layer + " forward calls", s.forward_calls == 2 * n_samples / batch_size);
+        check(layer + " backward calls", s.backward_calls == 2 * n_samples / batch_size);
+        check(layer + " update calls", s.update_calls == 2 * n_samples / batch_size);
+        check(layer + " samples", s.samples == 2 * n_samples);
+        check(layer + " flops", s.flops > 0);
+        check(layer + " time", s.forward_ns + s.backward_ns > 0);
+    }
+    check("first layer allocations", (stats.size() == 2) && (stats[0].bytes_allocated > 0));
+
+    check("other net untouched", b.instrumentation().snapshot().empty());
+
+    nntlib::state_pool<net_t> pool(b, 1);
+    std::vector<T> out(1);
+    for (const auto& xi : x) {
+        pool.forward(xi.begin(), xi.end(), out.begin());
+    }
+    auto stats_b = b.instrumentation().snapshot();
+    check("state pool counts on its net", (stats_b.size() == 2) && (stats_b[0].forward_calls == n_samples) && (stats_b[0].backward_calls == 0));
+    check("state pool does not count on other nets", a.instrumentation().snapshot()[0].forward_calls == 2 * n_samples / batch_size);
+
+    net_t copy = a;
+    copy.forward(x[0].begin(), x[0].end());
+    check("copies share counters", a.instrumentation().snapshot()[0].forward_calls == 2 * n_samples / batch_size + 1);
+
+    a.instrumentation().reset();
+    check("reset", a.instrumentation().snapshot().empty() && !b.instrumentation().snapshot().empty());
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
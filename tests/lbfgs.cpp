@@ -0,0 +1,190 @@
+#include <nntlib/nntlib.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Checks that the L-BFGS trainer (two-loop recursion) produces the same
+ * weights as a reference implementation that builds the dense inverse Hessian
+ * approximation from the same history, for a few rounds on a small net.
+ *
+ * Usage: lbfgs
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+
+constexpr std::size_t n_samples = 500;
+constexpr std::size_t batch_size = 100;
+constexpr std::size_t n_rounds = 3;
+constexpr T l2 = 0.01;
+constexpr T tolerance = 1e-9;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> layer_t;
+typedef nntlib::net<T, nntlib::loss::mse<T>, layer_t, layer_t> net_t;
+
+/* L-BFGS with a dense n x n inverse Hessian approximation, updated with every
+ * history entry, starting at the identity.
+ */
+class reference_lbfgs : public nntlib::training::_::batch_template<T> {
+    public:
+        typedef nntlib::training::_::batch_template<T> base_t;
+
+        reference_lbfgs(std::size_t history_size, func_factor_t func_factor, std::size_t batch_size, std::size_t n_rounds, T l2 = 0.0) :
+                base_t([](std::size_t _i){return 1.0;}, batch_size, n_rounds, l2),
+                ffactor(func_factor), histsize(history_size) {
+            base_t::callback_round([&](std::size_t round){
+                nround = round + 1;
+            });
+        }
+
+        template <typename Net, typename InputIt1, typename InputIt2>
+        void train(Net& net, InputIt1 x_first, InputIt1 x_last, InputIt2 y_first, InputIt2 y_last) {
+            nround = 0;
+            matrix_t update_last;
+            matrix_t weights_last;
+            bool first = true;
+            std::list<std::pair<matrix_t, matrix_t>> history;
+
+            auto hook = [&](typename Net::weights_t& update){
+                auto update_current = update2vector(update, -1.0);
+                auto weights_current = update2vector(net.weights_view(), 1.0);
+
+                if (first) {
+                    first = false;
+                } else {
+                    history.emplace_back(weights_current - weights_last, update_current - update_last);
+                }
+
+                auto id = matrix_t::Identity(update_current.rows(), update_current.rows());
+                matrix_t bk = id;
+                for (const auto& entry : history) {
+                    const matrix_t& sk = entry.first;
+                    const matrix_t& yk = entry.second;
+                    T norm = (yk.transpose() * sk)(0, 0);
+
+                    bk = (id - (sk * yk.transpose()) / norm)
+                        *  bk
+                        * (id - (yk * sk.transpose()) / norm)
+                        + (sk * sk.transpose()) / norm;
+                }
+
+                matrix_t direction = bk * update_current;
+                std::size_t pos = 0;
+                T factor = -ffactor(nround);
+                nntlib::utils::tuple_apply(update, [&](auto& part){
+                    for (auto& x : part) {
+                        for (T& y : x) {
+                            y = direction(pos++, 0) * factor;
+                        }
+                    }
+                });
+
+                while (history.size() > histsize) {
+                    history.pop_front();
+                }
+
+                update_last = std::move(update_current);
+                weights_last = std::move(weights_current);
+            };
+            base_t::train_impl(net, x_first, x_last, y_first, y_last, hook);
+        }
+
+    private:
+        typedef Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
+        func_factor_t ffactor;
+        std::size_t histsize;
+        std::size_t nround;
+
+        template <typename Weights>
+        static matrix_t update2vector(const Weights& weights, T factor) {
+            std::vector<T> vector;
+            nntlib::utils::tuple_apply(weights, [&](const auto& part){
+                for (const auto& x : part) {
+                    for (T y : x) {
+                        vector.push_back(y * factor);
+                    }
+                }
+            });
+            matrix_t result(vector.size(), 1);
+            for (std::size_t i = 0; i < vector.size(); ++i) {
+                result(i, 0) = vector[i];
+            }
+            return result;
+        }
+};
+
+std::size_t failures = 0;
+
+/* Maximum absolute difference of the weights of two nets with the same layout.
+ */
+T weights_diff(const net_t& a, const net_t& b) {
+    T result = 0.0;
+    auto wa = a.weights_view();
+    auto wb = b.weights_view();
+    nntlib::utils::tuple_join([&](const auto& lhs, const auto& rhs){
+        auto it = rhs.begin();
+        for (const auto& x : lhs) {
+            for (std::size_t i = 0; i < x.size(); ++i) {
+                result = std::max(result, std::abs(x[i] - (*it)[i]));
+            }
+            ++it;
+        }
+    }, wa, wb);
+    return result;
+}
+
+void check_history(std::size_t history_size, const dense_set& x, const dense_set& y) {
+    std::mt19937 rng_a(1);
+    layer_t a1(2, 8, rng_a);
+    layer_t a2(8, 1, rng_a);
+    net_t a(a1, a2);
+    std::mt19937 rng_b(1);
+    layer_t b1(2, 8, rng_b);
+    layer_t b2(8, 1, rng_b);
+    net_t b(b1, b2);
+
+    auto lr = nntlib::training::lbfgs<T>::func_factor_exp(0.7, 0.95);
+    nntlib::training::lbfgs<T> trainer(history_size, lr, batch_size, n_rounds, l2);
+    trainer.train(a, x.begin(), x.end(), y.begin(), y.end());
+    reference_lbfgs reference(history_size, lr, batch_size, n_rounds, l2);
+    reference.train(b, x.begin(), x.end(), y.begin(), y.end());
+
+    T diff = weights_diff(a, b);
+    std::string check = "history " + std::to_string(history_size);
+    if (diff <= tolerance) {
+        std::cout << "ok    " << check << " (weights differ by " << diff << ")" << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << check << ": weights differ by " << diff << std::endl;
+    }
+}
+
+int main() {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<T> dist(-1, 1);
+    dense_set x;
+    dense_set y;
+    for (std::size_t i = 0; i < n_samples; ++i) {
+        T x1 = dist(rng);
+        T x2 = dist(rng);
+        x.push_back({x1, x2});
+        y.push_back({std::abs(x1 - x2) / 2});
+    }
+
+    // shorter than the number of updates, so entries get dropped and reused
+    check_history(3, x, y);
+    check_history(30, x, y);
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <nntlib/nntlib.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Checks that <nntlib::layer::pruned> meets its sparsity target after
+ * updates, training and reloading, and that
+ * <nntlib::layer::sparse_fully_connected> computes the same outputs as the
+ * dense pruned layer.
+ *
+ * Usage: pruning [directory]
+ *
+ * The stored model is written to the directory (default: /tmp) and removed
+ * afterwards.
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+
+constexpr std::size_t n_inputs = 100;
+constexpr std::size_t n_outputs = 50;
+constexpr std::size_t n_samples = 64;
+constexpr double sparsity = 0.9;
+constexpr std::size_t n_pruned = 4500;
+constexpr T tolerance = 1e-12;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> layer_t;
+typedef nntlib::layer::pruned<layer_t> pruned_t;
+typedef nntlib::layer::sparse_fully_connected<nntlib::activation::tanh<T>, T> sparse_t;
+
+std::size_t failures = 0;
+
+void check(const std::string& name, bool ok) {
+    if (ok) {
+        std::cout << "ok    " << name << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << name << std::endl;
+    }
+}
+
+dense_set random_set(std::size_t n, std::size_t dim, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n, std::vector<T>(dim));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    return x;
+}
+
+/* Number of input weights (i.e. without biases) that are zero.
+ */
+template <typename Weights>
+std::size_t count_zeros(const Weights& weights) {
+    std::size_t n = 0;
+    for (const auto& wj : weights) {
+        for (std::size_t i = 1; i < wj.size(); ++i) {
+            n += (wj[i] == 0) ? 1 : 0;
+        }
+    }
+    return n;
+}
+
+/* Largest absolute difference between the outputs of two nets, for single samples and for an entire batch.
+ */
+template <typename Net1, typename Net2>
+T max_output_diff(Net1& a, Net2& b, const dense_set& x) {
+    T result = 0.0;
+    nntlib::storage::row_matrix<T> block(n_inputs, x.size());
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        block.assign_col(i, x[i].begin(), x[i].end());
+    }
+    auto state_a = a.allocate_batch_state(x.size());
+    auto state_b = b.allocate_batch_state(x.size());
+    const auto& out_batch_a = a.forward_batch(block, x.size(), state_a);
+    const auto& out_batch_b = b.forward_batch(block, x.size(), state_b);
+
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        auto out_a = a.forward(x[i].begin(), x[i].end());
+        auto out_b = b.forward(x[i].begin(), x[i].end());
+        for (std::size_t j = 0; j < out_a.size(); ++j) {
+            result = std::max(result, std::abs(out_a[j] - out_b[j]));
+            result = std::max(result, std::abs(out_batch_a(j, i) - out_batch_b(j, i)));
+        }
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    std::string path = std::string((argc > 1) ? argv[1] : "/tmp") + "/nntlib-pruning-model";
+
+    auto x = random_set(n_samples, n_inputs, 2);
+    auto y = random_set(n_samples, n_outputs, 3);
+
+    std::mt19937 rng(1);
+    layer_t trained(n_inputs, n_outputs, rng);
+    pruned_t p(trained, sparsity);
+    check("sparsity", count_zeros(p.get_weights()) == n_pruned);
+    check("mask", count_zeros(p.get_mask()) == n_pruned);
+
+    bool same_bias = true;
+    for (std::size_t j = 0; j < n_outputs; ++j) {
+        same_bias = same_bias && (p.get_weights()[j][0] == trained.get_weights()[j][0]);
+    }
+    check("biases kept", same_bias);
+
+    // updates touch every weight, refresh has to zero the pruned ones again
+    layer_t::weights_t delta(p.get_weights());
+    std::uniform_real_distribution<T> dist(-0.1, 0.1);
+    for (auto dj : delta) {
+        for (auto& v : dj) {
+            v = dist(rng);
+        }
+    }
+    p.update(delta);
+    check("sparsity after update", count_zeros(p.get_weights()) == n_pruned);
+
+    auto net = nntlib::make_net<T, nntlib::loss::mse<T>>(p);
+    nntlib::training::batch<T> trainer([](std::size_t _round){return 0.01;}, 16, 2);
+    trainer.train(net, x.begin(), x.end(), y.begin(), y.end());
+    check("sparsity after training", count_zeros(p.get_weights()) == n_pruned);
+
+    // a differently pruned layer takes over the stored pruning
+    nntlib::model::save(net, path);
+    layer_t other(n_inputs, n_outputs, rng);
+    pruned_t q(other, 0.5);
+    auto net_q = nntlib::make_net<T, nntlib::loss::mse<T>>(q);
+    nntlib::model::load(net_q, path);
+    std::remove(path.c_str());
+    const auto& mask_p = p.get_mask();
+    const auto& mask_q = q.get_mask();
+    check("sparsity after reload", (count_zeros(q.get_weights()) == n_pruned) && std::equal(mask_p.data(), mask_p.data() + mask_p.buffer_size(), mask_q.data()));
+    q.update(delta);
+    check("sparsity after reload and update", count_zeros(q.get_weights()) == n_pruned);
+
+    sparse_t s(p);
+    auto net_s = nntlib::make_net<T, nntlib::loss::mse<T>>(s);
+    check("sparse nnz", s.nnz() == n_outputs * n_inputs - n_pruned);
+    check("sparse matches pruned", max_output_diff(net, net_s, x) <= tolerance);
+
+    // pruning during the conversion keeps the same weights as <pruned>
+    sparse_t s_direct(trained, sparsity);
+    pruned_t p_direct(trained, sparsity);
+    auto net_s_direct = nntlib::make_net<T, nntlib::loss::mse<T>>(s_direct);
+    auto net_p_direct = nntlib::make_net<T, nntlib::loss::mse<T>>(p_direct);
+    check("sparse conversion with sparsity", (s_direct.nnz() == s.nnz()) && (max_output_diff(net_p_direct, net_s_direct, x) <= tolerance));
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
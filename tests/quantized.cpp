@@ -0,0 +1,142 @@
+#include <nntlib/nntlib.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Checks the accuracy of <nntlib::layer::quantized_fully_connected> against
+ * the layer it was built from, and that the integer dot product matches a
+ * plain loop. The dot product uses VNNI, AVX2 or a scalar loop depending on
+ * the compiler flags, so run both the default and the -native build to cover
+ * the scalar and the SIMD path.
+ *
+ * Usage: quantized
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+
+constexpr std::size_t n_inputs = 100;
+constexpr std::size_t n_outputs = 50;
+constexpr std::size_t n_samples = 200;
+
+/* Largest absolute output error of the quantized tanh layer. Weights are
+ * rounded to 1/254 and inputs to 1/126 of their range, the measured error of
+ * this setup is about 0.02.
+ */
+constexpr T max_error = 0.05;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> layer_t;
+typedef nntlib::layer::quantized_fully_connected<nntlib::activation::tanh<T>, T> quantized_t;
+
+std::size_t failures = 0;
+
+void check(const std::string& name, bool ok) {
+    if (ok) {
+        std::cout << "ok    " << name << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << name << std::endl;
+    }
+}
+
+const char* dot_path() {
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+    return "vnni";
+#elif defined(__AVX2__)
+    return "avx2";
+#else
+    return "scalar";
+#endif
+}
+
+void check_dot() {
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> dist_x(0, 127);
+    std::uniform_int_distribution<int> dist_w(-0.2, 0.2);
+
+    bool same = true;
+    for (std::size_t n : {64, 128, 1024}) {
+        std::vector<std::uint8_t, nntlib::storage::aligned_allocator<std::uint8_t>> x(n);
+        std::vector<std::int8_t, nntlib::storage::aligned_allocator<std::int8_t>> w(n);
+        std::int32_t expected = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            x[i] = static_cast<std::uint8_t>(dist_x(rng));
+            w[i] = static_cast<std::int8_t>(dist_w(rng));
+            expected += static_cast<std::int32_t>(x[i]) * static_cast<std::int32_t>(w[i]);
+        }
+
+        // extreme values, the largest products must not saturate
+        std::vector<std::uint8_t, nntlib::storage::aligned_allocator<std::uint8_t>> x_max(n, 127);
+        std::vector<std::int8_t, nntlib::storage::aligned_allocator<std::int8_t>> w_min(n, -128);
+
+        same = same
+            && (nntlib::layer::_::dot_u8s8(x.data(), w.data(), n) == expected)
+            && (nntlib::layer::_::dot_u8s8(x_max.data(), w_min.data(), n) == -127 * 128 * static_cast<std::int32_t>(n));
+    }
+    check(std::string("dot product (") + dot_path() + ")", same);
+}
+
+void check_layer() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n_samples, std::vector<T>(n_inputs));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+
+    // weights of a trained layer are larger than the initial ones
+    layer_t l(n_inputs, n_outputs, rng);
+    auto net = nntlib::make_net<T, nntlib::loss::mse<T>>(l);
+    std::uniform_real_distribution<T> dist_w(-0.2, 0.2);
+    auto weights = net.weights_view();
+    nntlib::utils::tuple_apply(weights, [&](auto& w){
+        for (auto wj : w) {
+            for (auto& v : wj) {
+                v = dist_w(rng);
+            }
+        }
+    });
+    net.reload();
+    quantized_t q(l, x.begin(), x.end());
+    auto net_q = nntlib::make_net<T, nntlib::loss::mse<T>>(q);
+
+    T error = 0.0;
+    T batch_diff = 0.0;
+    nntlib::storage::row_matrix<T> block(n_inputs, n_samples);
+    for (std::size_t b = 0; b < n_samples; ++b) {
+        block.assign_col(b, x[b].begin(), x[b].end());
+    }
+    auto state = net_q.allocate_batch_state(n_samples);
+    const auto& out_batch = net_q.forward_batch(block, n_samples, state);
+    for (std::size_t b = 0; b < n_samples; ++b) {
+        auto out = net.forward(x[b].begin(), x[b].end());
+        auto out_q = net_q.forward(x[b].begin(), x[b].end());
+        for (std::size_t j = 0; j < n_outputs; ++j) {
+            error = std::max(error, std::abs(out[j] - out_q[j]));
+            batch_diff = std::max(batch_diff, std::abs(out_q[j] - out_batch(j, b)));
+        }
+    }
+
+    std::cout << "      max error " << error << ", batch differs by " << batch_diff << std::endl;
+    check("error bound", error <= max_error);
+    // integer parts are the same, only the activation may round differently
+    check("batch matches single samples", batch_diff <= 1e-12);
+}
+
+int main() {
+    check_dot();
+    check_layer();
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
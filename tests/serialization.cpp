@@ -0,0 +1,293 @@
+#include <nntlib/nntlib.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/* Checks that datasets (<nntlib::dataset::write>, <nntlib::dataset::mapped>)
+ * and models (<nntlib::model::save>, <nntlib::model::load>) survive a round
+ * trip and that broken files get rejected: wrong magic, wrong value type,
+ * truncated files and nets with a different topology.
+ *
+ * Usage: serialization [directory]
+ *
+ * The files are written to the directory (default: /tmp) and removed
+ * afterwards.
+ */
+
+typedef double T;
+typedef std::vector<std::vector<T>> dense_set;
+
+typedef nntlib::layer::fully_connected<nntlib::activation::tanh<T>, T> hidden_t;
+typedef nntlib::layer::fully_connected<nntlib::activation::identity<T>, T> output_t;
+typedef nntlib::layer::fully_connected_mixed<nntlib::activation::tanh<T>, nntlib::storage::bfloat16, T> mixed_t;
+typedef nntlib::net<T, nntlib::loss::mse<T>, hidden_t, output_t> net_t;
+
+std::size_t failures = 0;
+std::string directory = "/tmp";
+std::vector<std::string> files;
+
+void check(const std::string& name, bool ok) {
+    if (ok) {
+        std::cout << "ok    " << name << std::endl;
+    } else {
+        ++failures;
+        std::cout << "FAIL  " << name << std::endl;
+    }
+}
+
+/* Checks that func throws Exception with a message that contains the given text.
+ */
+template <typename Exception>
+void check_error(const std::string& name, const std::string& text, std::function<void()> func) {
+    try {
+        func();
+        ++failures;
+        std::cout << "FAIL  " << name << ": no exception" << std::endl;
+    } catch (const Exception& e) {
+        std::string what = e.what();
+        check(name, what.find(text) != std::string::npos);
+    }
+}
+
+std::string path(const std::string& name) {
+    std::string p = directory + "/nntlib-serialization-" + name;
+    files.push_back(p);
+    return p;
+}
+
+std::string read_file(const std::string& p) {
+    std::ifstream in(p, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string& p, const std::string& content) {
+    std::ofstream out(p, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+dense_set random_set(std::size_t n, std::size_t dim, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    dense_set x(n, std::vector<T>(dim));
+    for (auto& xi : x) {
+        for (auto& v : xi) {
+            v = dist(rng);
+        }
+    }
+    return x;
+}
+
+/* Returns true if both nets have exactly the same weights.
+ */
+template <typename Net>
+bool same_weights(const Net& a, const Net& b) {
+    bool result = true;
+    auto wa = a.weights_view();
+    auto wb = b.weights_view();
+    nntlib::utils::tuple_join([&](const auto& lhs, const auto& rhs){
+        result = result && std::equal(lhs.data(), lhs.data() + lhs.buffer_size(), rhs.data());
+    }, wa, wb);
+    return result;
+}
+
+void check_dataset() {
+    auto x = random_set(10, 3, 1);
+    auto y = random_set(10, 2, 2);
+    // short rows get padded with zeros
+    x[4].resize(1);
+
+    std::string p = path("dataset");
+    nntlib::dataset::write<T>(p, 3, 2, x.begin(), x.end(), y.begin(), y.end());
+
+    {
+        nntlib::dataset::mapped<T> data(p);
+        check("dataset shape", (data.rows() == 10) && (data.size_in() == 3) && (data.size_out() == 2));
+        check("dataset iterators", (data.x_end() - data.x_begin() == 10) && (data.y_end() - data.y_begin() == 10));
+
+        bool same = true;
+        std::size_t i = 0;
+        for (auto it = data.x_begin(); it != data.x_end(); ++it, ++i) {
+            for (std::size_t j = 0; j < 3; ++j) {
+                T expected = (j < x[i].size()) ? x[i][j] : T(0);
+                same = same && (it->size() == 3) && ((*it)[j] == expected);
+            }
+        }
+        i = 0;
+        for (auto it = data.y_begin(); it != data.y_end(); ++it, ++i) {
+            same = same && (it->size() == 2) && ((*it)[0] == y[i][0]) && ((*it)[1] == y[i][1]);
+        }
+        check("dataset round trip", same);
+        check("dataset random access", (data.x_begin()[7][2] == x[7][2]) && ((data.y_begin() + 9)->operator[](1) == y[9][1]));
+    }
+
+    {
+        std::string p_empty = path("dataset-empty");
+        nntlib::dataset::write<T>(p_empty, 3, 2, x.begin(), x.begin(), y.begin(), y.begin());
+        nntlib::dataset::mapped<T> data(p_empty);
+        check("dataset empty", (data.rows() == 0) && (data.x_begin() == data.x_end()));
+    }
+
+    std::string content = read_file(p);
+
+    check_error<std::runtime_error>("dataset wrong type", "different value type", [&]{
+        nntlib::dataset::mapped<float> data(p);
+    });
+
+    std::string p_magic = path("dataset-magic");
+    std::string broken = content;
+    broken[0] = 'X';
+    write_file(p_magic, broken);
+    check_error<std::runtime_error>("dataset wrong magic", "wrong magic", [&]{
+        nntlib::dataset::mapped<T> data(p_magic);
+    });
+
+    std::string p_truncated = path("dataset-truncated");
+    write_file(p_truncated, content.substr(0, content.size() - sizeof(T)));
+    check_error<std::runtime_error>("dataset truncated", "truncated", [&]{
+        nntlib::dataset::mapped<T> data(p_truncated);
+    });
+
+    std::string p_short = path("dataset-short");
+    write_file(p_short, content.substr(0, 16));
+    check_error<std::runtime_error>("dataset too short", "too short", [&]{
+        nntlib::dataset::mapped<T> data(p_short);
+    });
+
+    check_error<std::system_error>("dataset missing file", "cannot open", [&]{
+        nntlib::dataset::mapped<T> data(directory + "/nntlib-serialization-missing");
+    });
+
+    check_error<std::runtime_error>("dataset without values", "without any values", [&]{
+        nntlib::dataset::write<T>(path("dataset-novalues"), 0, 0, x.begin(), x.end(), y.begin(), y.end());
+    });
+}
+
+void check_model() {
+    auto x = random_set(5, 3, 3);
+
+    std::mt19937 rng(1);
+    hidden_t a1(3, 8, rng);
+    output_t a2(8, 2, rng);
+    net_t a(a1, a2);
+    hidden_t b1(3, 8, rng);
+    output_t b2(8, 2, rng);
+    net_t b(b1, b2);
+
+    std::string p = path("model");
+    nntlib::model::save(a, p);
+    nntlib::model::load(b, p);
+    check("model round trip", same_weights(a, b));
+
+    // compact copies get rebuilt after loading
+    mixed_t m1(3, 8, rng);
+    output_t m2(8, 2, rng);
+    nntlib::net<T, nntlib::loss::mse<T>, mixed_t, output_t> m(m1, m2);
+    mixed_t n1(3, 8, rng);
+    output_t n2(8, 2, rng);
+    nntlib::net<T, nntlib::loss::mse<T>, mixed_t, output_t> n(n1, n2);
+    std::string p_mixed = path("model-mixed");
+    nntlib::model::save(m, p_mixed);
+    nntlib::model::load(n, p_mixed);
+    bool same_output = true;
+    for (const auto& xi : x) {
+        auto out_m = m.forward(xi.begin(), xi.end());
+        auto out_n = n.forward(xi.begin(), xi.end());
+        same_output = same_output && std::equal(out_m.begin(), out_m.end(), out_n.begin());
+    }
+    check("model round trip mixed", same_weights(m, n) && same_output);
+
+    std::string content = read_file(p);
+
+    // failed loads must not touch the net
+    hidden_t c1(3, 8, rng);
+    output_t c2(8, 2, rng);
+    net_t c(c1, c2);
+    hidden_t d1 = c1;
+    output_t d2 = c2;
+    net_t d(d1, d2);
+
+    std::string p_magic = path("model-magic");
+    std::string broken = content;
+    broken[0] = 'X';
+    write_file(p_magic, broken);
+    check_error<std::runtime_error>("model wrong magic", "wrong magic", [&]{
+        nntlib::model::load(c, p_magic);
+    });
+
+    std::string p_truncated = path("model-truncated");
+    write_file(p_truncated, content.substr(0, content.size() - sizeof(T)));
+    check_error<std::runtime_error>("model truncated", "truncated", [&]{
+        nntlib::model::load(c, p_truncated);
+    });
+
+    std::string p_short = path("model-short");
+    write_file(p_short, content.substr(0, 16));
+    check_error<std::runtime_error>("model too short", "too short", [&]{
+        nntlib::model::load(c, p_short);
+    });
+
+    check_error<std::runtime_error>("model wrong type", "different value type", [&]{
+        std::mt19937 rng_f(1);
+        nntlib::layer::fully_connected<nntlib::activation::tanh<float>, float> f1(3, 8, rng_f);
+        nntlib::layer::fully_connected<nntlib::activation::identity<float>, float> f2(8, 2, rng_f);
+        auto f = nntlib::make_net<float, nntlib::loss::mse<float>>(f1, f2);
+        nntlib::model::load(f, p);
+    });
+
+    check_error<std::runtime_error>("model different shape", "different topology", [&]{
+        hidden_t e1(3, 7, rng);
+        output_t e2(7, 2, rng);
+        net_t e(e1, e2);
+        nntlib::model::load(e, p);
+    });
+
+    check_error<std::runtime_error>("model different layer types", "different topology", [&]{
+        output_t e1(3, 8, rng);
+        output_t e2(8, 2, rng);
+        auto e = nntlib::make_net<T, nntlib::loss::mse<T>>(e1, e2);
+        nntlib::model::load(e, p);
+    });
+
+    check_error<std::runtime_error>("model different depth", "different topology", [&]{
+        hidden_t e1(3, 8, rng);
+        hidden_t e2(8, 8, rng);
+        output_t e3(8, 2, rng);
+        auto e = nntlib::make_net<T, nntlib::loss::mse<T>>(e1, e2, e3);
+        nntlib::model::load(e, p);
+    });
+
+    check_error<std::system_error>("model missing file", "cannot open", [&]{
+        nntlib::model::load(c, directory + "/nntlib-serialization-missing");
+    });
+
+    check("model untouched after errors", same_weights(c, d));
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        directory = argv[1];
+    }
+
+    check_dataset();
+    check_model();
+
+    for (const auto& p : files) {
+        std::remove(p.c_str());
+    }
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}